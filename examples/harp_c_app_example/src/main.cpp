@@ -1,6 +1,7 @@
 #include <cstring>
 #include <harp_c_app.h>
 #include <harp_synchronizer.h>
+#include <harp_clock_generator.h>
 #include <core_registers.h>
 #include <reg_types.h>
 #ifdef DEBUG
@@ -76,10 +77,21 @@ int main()
 // Init Synchronizer.
     HarpSynchronizer& sync = HarpSynchronizer::init(uart1, 5);
     app.set_synchronizer(&sync);
+    // Optional: send the Harp clock on uart0's tx pin when the PC sets
+    // CLK_GEN in R_CLOCK_CONFIG.
+    //app.set_clock_generator(&HarpClockGenerator::init(uart0, 0));
+    // Optional: run register writes, events, or callbacks at Harp times with
+    // HarpScheduler::write_at(), event_at(), or call_at().
+    //app.set_scheduler(&HarpScheduler::init());
 #ifdef DEBUG
     stdio_uart_init_full(uart0, 921600, 0, -1); // use uart1 tx only.
     printf("Hello, from an RP2040!\r\n");
 #endif
+    // Optional: run the app on core1 and leave usb handling on core0.
+    //HarpCore::launch_app_on_core1();
+    // Optional: sleep in run() until there is something to do instead of
+    // polling. update_app_state() then only runs after interrupts.
+    //HarpCore::set_idle_policy(IDLE_SLEEP);
     while(true)
     {
         app.run();
@@ -4,11 +4,62 @@
 #include <reg_types.h>
 #include <core_reg_bits.h>
 #include <cstring>  // for strcpy
+#include <cstddef>  // for offsetof
+#include <type_traits>
 
-static const uint8_t CORE_REG_COUNT = 18;
+static const uint8_t CORE_REG_COUNT = 26;
+static const uint8_t COMMON_REG_COUNT = 18; // Harp spec common registers.
+static const uint8_t DIAG_REG_COUNT = CORE_REG_COUNT - COMMON_REG_COUNT;
 
 #define APP_REG_START_ADDRESS (32)
 
+// The remaining core registers (usb and sync diagnostics, time sync over usb)
+// are not in the Harp spec. The spec reserves addresses up to
+// APP_REG_START_ADDRESS for common registers, and newer versions of it keep
+// adding them there, so these live in a vendor-private range at the top of
+// the address space instead. App registers must end below it.
+#ifndef DIAG_REG_START_ADDRESS
+#define DIAG_REG_START_ADDRESS (248)
+#endif
+
+static_assert((DIAG_REG_START_ADDRESS >= COMMON_REG_COUNT)
+              && (DIAG_REG_START_ADDRESS + DIAG_REG_COUNT <= 256),
+              "Diagnostic core registers must fit above the common ones.");
+
+/**
+ * \brief index of the core register at \p address into the core register
+ *  tables, which list the common registers and then the diagnostic ones.
+ * \return CORE_REG_COUNT if \p address is not a core register.
+ */
+constexpr uint8_t core_reg_index(uint8_t address)
+{
+    if (address < COMMON_REG_COUNT)
+        return address;
+    if ((address >= DIAG_REG_START_ADDRESS)
+        && (address < DIAG_REG_START_ADDRESS + DIAG_REG_COUNT))
+        return COMMON_REG_COUNT + (address - DIAG_REG_START_ADDRESS);
+    return CORE_REG_COUNT;
+}
+
+/**
+ * \brief address of the core register at \p index into the core register
+ *  tables. Inverse of core_reg_index().
+ */
+constexpr uint8_t core_reg_address(uint8_t index)
+{
+    return (index < COMMON_REG_COUNT)?
+        index: uint8_t(DIAG_REG_START_ADDRESS + (index - COMMON_REG_COUNT));
+}
+
+// Core lookup tables are generated at compile time and live in flash.
+// Optionally, define HARP_CORE_TABLES_IN_RAM to copy them to RAM at boot such
+// that lookups never wait on an XIP cache miss.
+#if defined(HARP_CORE_TABLES_IN_RAM)
+#define HARP_CORE_TABLE_ATTR __attribute__((section(".time_critical.harp_core_tables")))
+#else
+#define HARP_CORE_TABLE_ATTR
+#endif
+
 // R_OPERATION_CTRL bitfields.
 #define DUMP_OFFSET (3)
 #define MUTE_RPL_OFFSET (4)
@@ -22,6 +73,14 @@ static const uint8_t CORE_REG_COUNT = 18;
 #define BOOT_DEF_OFFSET (6)
 #define BOOT_EE_OFFSET (7)
 
+// R_CLOCK_CONFIG bitfields.
+#define CLK_REP_OFFSET (0)
+#define CLK_GEN_OFFSET (1)
+#define REP_ABLE_OFFSET (3)
+#define GEN_ABLE_OFFSET (4)
+#define CLK_UNLOCK_OFFSET (6)
+#define CLK_LOCK_OFFSET (7)
+
 /**
  * \brief enum for easier interpretation of the OP_MODE bitfield in the
  *  R_OPERATION_CTRL register.
@@ -58,11 +117,111 @@ enum RegName : uint8_t
     TIMESTAMP_OFFSET = 15,
     UUID = 16,
     TAG = 17,
+    // Vendor-private diagnostic registers. Not in the Harp spec.
+    TX_STATS = DIAG_REG_START_ADDRESS,
+    EVENT_QUEUE_STATS = DIAG_REG_START_ADDRESS + 1,
+    RX_ERRORS = DIAG_REG_START_ADDRESS + 2,
+    SYNC_QUALITY = DIAG_REG_START_ADDRESS + 3,
+    SYNC_COUNTERS = DIAG_REG_START_ADDRESS + 4,
+    TIME_PROBE = DIAG_REG_START_ADDRESS + 5,
+    TIME_ADJUST = DIAG_REG_START_ADDRESS + 6,
+    RX_LATENCY = DIAG_REG_START_ADDRESS + 7,
 };
 
 
 // Byte-align struct data so we can send it out serially byte-by-byte.
 #pragma pack(push, 1)
+/**
+ * \brief outgoing usb traffic counters. Read as an array of U32.
+ * \details packing efficiency is
+ *  \f$ bytes / ((full\_packets + short\_packets) * 64) \f$.
+ */
+struct TxStats
+{
+    uint32_t frames;        ///< harp messages queued for sending.
+    uint32_t bytes;         ///< harp message bytes queued for sending.
+    uint32_t full_packets;  ///< usb packets sent completely full.
+    uint32_t short_packets; ///< usb packets sent partially full by a flush.
+    uint32_t dropped_frames;///< harp messages dropped for lack of tx space.
+};
+
+/**
+ * \brief counters for events posted with HarpCore::post_event_from_isr().
+ *  Read as an array of U32.
+ */
+struct EventQueueStats
+{
+    uint32_t posted;    ///< events queued since startup.
+    uint32_t dropped;   ///< events dropped because the queue was full.
+    uint32_t high_water;///< most events pending at once.
+    uint32_t capacity;  ///< max number of pending events.
+};
+
+/**
+ * \brief incoming message error counters. Read as an array of U32.
+ */
+struct RxErrors
+{
+    uint32_t checksum_errors;  ///< complete messages with a bad checksum.
+    uint32_t framing_errors;   ///< bytes that could not start a message.
+    uint32_t timeouts;         ///< partial messages that never completed.
+    uint32_t dropped_bytes;    ///< bytes skipped to find the next message.
+    uint32_t oversize_msgs;    ///< app messages too large to pass to core1.
+};
+
+/**
+ * \brief external clock sync quality. Read as an array of S32.
+ * \details residuals are the differences between each sync packet's time and
+ *  the local Harp time when it arrived, before correction. Running values
+ *  average over about 2^HARP_SYNC_STATS_SHIFT packets.
+ */
+struct SyncQuality
+{
+    int32_t last_residual_ns;  ///< residual of the last sync packet.
+    int32_t mean_residual_ns;  ///< running mean of the residuals.
+    int32_t jitter_ns;         ///< running mean absolute deviation.
+    int32_t drift_ppb;         ///< estimated crystal drift. Positive if slow.
+};
+
+/**
+ * \brief external clock sync counters. Read as an array of U32.
+ */
+struct SyncCounters
+{
+    uint32_t packets_received; ///< complete sync packets received.
+    uint32_t packets_rejected; ///< sync packets not used to steer the clock.
+    uint32_t sync_age_ms;      ///< time since the last valid sync packet.
+                               ///< UINT32_MAX if never synced.
+    uint32_t lock_losses;      ///< times the sync lock was lost.
+};
+
+/**
+ * \brief device side of a round-trip time exchange with the PC. Read as an
+ *  array of U64.
+ * \details written by the device whenever the PC writes to the register.
+ *  Times are in full-resolution Harp time, unlike message timestamps.
+ */
+struct TimeProbe
+{
+    uint64_t rx_harp_time_us; ///< when the write request was received.
+    uint64_t tx_harp_time_us; ///< when its reply was sent.
+};
+
+/**
+ * \brief time that incoming messages waited from the read of their last
+ *  byte until core0 dispatched them (to a handler, or to core1). Read as an
+ *  array of U32.
+ * \details the mean wait over an interval is the difference in
+ *  total_wait_us divided by the difference in messages between two reads.
+ */
+struct RxLatency
+{
+    uint32_t messages;      ///< messages dispatched since startup.
+    uint32_t last_wait_us;  ///< wait of the most recent message.
+    uint32_t max_wait_us;   ///< longest wait since startup.
+    uint32_t total_wait_us; ///< sum of all waits. Wraps around.
+};
+
 struct RegValues
 {
     const uint16_t R_WHO_AM_I;
@@ -83,6 +242,14 @@ struct RegValues
     volatile uint8_t R_TIMESTAMP_OFFSET;
     uint8_t R_UUID[16];
     uint8_t R_TAG[8];
+    volatile TxStats R_TX_STATS;
+    volatile EventQueueStats R_EVENT_QUEUE_STATS;
+    volatile RxErrors R_RX_ERRORS;
+    volatile SyncQuality R_SYNC_QUALITY;
+    volatile SyncCounters R_SYNC_COUNTERS;
+    volatile TimeProbe R_TIME_PROBE;
+    volatile int32_t R_TIME_ADJUST;
+    volatile RxLatency R_RX_LATENCY;
 };
 #pragma pack(pop)
 
@@ -93,6 +260,47 @@ struct RegSpecs
     const reg_type_t payload_type;
 };
 
+/**
+ * \brief specs for a core register stored as an offset into RegValues such
+ *  that the table of them can be generated at compile time.
+ */
+struct CoreRegSpecs
+{
+    uint8_t offset;
+    uint8_t num_bytes;
+    reg_type_t payload_type;
+};
+
+/**
+ * \brief create the CoreRegSpecs for a RegValues field and check at compile
+ *  time that the field's size and element type match the \p payload_type.
+ */
+template <typename FieldType, reg_type_t payload_type>
+constexpr CoreRegSpecs make_core_reg_specs(size_t offset)
+{
+    using ElementType = std::remove_cv_t<std::remove_all_extents_t<FieldType>>;
+    constexpr size_t type_size = payload_type & 0x0F;
+    constexpr bool is_signed = bool(payload_type & IS_SIGNED);
+    constexpr bool is_float = bool(payload_type & IS_FLOAT);
+    static_assert(sizeof(FieldType) % type_size == 0,
+                  "Register size is not a multiple of its payload type size.");
+    static_assert(!std::is_arithmetic_v<ElementType>
+                  || sizeof(ElementType) == type_size,
+                  "Register element size does not match its payload type.");
+    static_assert(!std::is_arithmetic_v<ElementType>
+                  || std::is_floating_point_v<ElementType> == is_float,
+                  "Register float-ness does not match its payload type.");
+    static_assert(!std::is_integral_v<ElementType>
+                  || std::is_same_v<ElementType, char> // strings are U8.
+                  || std::is_signed_v<ElementType> == is_signed,
+                  "Register signedness does not match its payload type.");
+    return {uint8_t(offset), uint8_t(sizeof(FieldType)), payload_type};
+}
+
+#define CORE_REG_SPECS(field, payload_type) \
+    make_core_reg_specs<decltype(RegValues::field), payload_type>( \
+        offsetof(RegValues, field))
+
 struct Registers
 {
     public:
@@ -109,32 +317,72 @@ struct Registers
 
     // Lookup table. Necessary because register data is not of equal size,
     //  so we can't index into it directly by enum.
-    // TODO: consider generating this table statically with a template.
-    const RegSpecs address_to_specs[CORE_REG_COUNT] =
-    {{(uint8_t*)&regs_.R_WHO_AM_I,         sizeof(regs_.R_WHO_AM_I),          U16},
-     {(uint8_t*)&regs_.R_HW_VERSION_H,     sizeof(regs_.R_HW_VERSION_H),      U8},
-     {(uint8_t*)&regs_.R_HW_VERSION_L,     sizeof(regs_.R_HW_VERSION_L),      U8},
-     {(uint8_t*)&regs_.R_ASSEMBLY_VERSION, sizeof(regs_.R_ASSEMBLY_VERSION),  U8},
-     {(uint8_t*)&regs_.R_HARP_VERSION_H,   sizeof(regs_.R_HARP_VERSION_H),    U8},
-     {(uint8_t*)&regs_.R_HARP_VERSION_L,   sizeof(regs_.R_HW_VERSION_L),      U8},
-     {(uint8_t*)&regs_.R_FW_VERSION_H,     sizeof(regs_.R_FW_VERSION_H),      U8},
-     {(uint8_t*)&regs_.R_FW_VERSION_L,     sizeof(regs_.R_FW_VERSION_L),      U8},
-     {(uint8_t*)&regs_.R_TIMESTAMP_SECOND, sizeof(regs_.R_TIMESTAMP_SECOND),  U32},
-     {(uint8_t*)&regs_.R_TIMESTAMP_MICRO,  sizeof(regs_.R_TIMESTAMP_MICRO),   U16},
-     {(uint8_t*)&regs_.R_OPERATION_CTRL,   sizeof(regs_.R_OPERATION_CTRL),    U8},
-     {(uint8_t*)&regs_.R_RESET_DEF,        sizeof(regs_.R_RESET_DEF),         U8},
-     {(uint8_t*)&regs_.R_DEVICE_NAME,      sizeof(regs_.R_DEVICE_NAME),       U8},
-     {(uint8_t*)&regs_.R_SERIAL_NUMBER,    sizeof(regs_.R_SERIAL_NUMBER),     U16},
-     {(uint8_t*)&regs_.R_CLOCK_CONFIG,     sizeof(regs_.R_CLOCK_CONFIG),      U8},
-     {(uint8_t*)&regs_.R_TIMESTAMP_OFFSET, sizeof(regs_.R_TIMESTAMP_OFFSET),  U8},
-     {(uint8_t*)&regs_.R_UUID, sizeof(regs_.R_UUID),  U8},
-     {(uint8_t*)&regs_.R_TAG, sizeof(regs_.R_TAG),  U8},
+    // Generated at compile time, so it lives in flash rather than RAM.
+    // Indexed by core_reg_index().
+    inline static constexpr CoreRegSpecs address_to_specs[CORE_REG_COUNT]
+    HARP_CORE_TABLE_ATTR =
+    {CORE_REG_SPECS(R_WHO_AM_I,           U16),
+     CORE_REG_SPECS(R_HW_VERSION_H,       U8),
+     CORE_REG_SPECS(R_HW_VERSION_L,       U8),
+     CORE_REG_SPECS(R_ASSEMBLY_VERSION,   U8),
+     CORE_REG_SPECS(R_HARP_VERSION_H,     U8),
+     CORE_REG_SPECS(R_HARP_VERSION_L,     U8),
+     CORE_REG_SPECS(R_FW_VERSION_H,       U8),
+     CORE_REG_SPECS(R_FW_VERSION_L,       U8),
+     CORE_REG_SPECS(R_TIMESTAMP_SECOND,   U32),
+     CORE_REG_SPECS(R_TIMESTAMP_MICRO,    U16),
+     CORE_REG_SPECS(R_OPERATION_CTRL,     U8),
+     CORE_REG_SPECS(R_RESET_DEF,          U8),
+     CORE_REG_SPECS(R_DEVICE_NAME,        U8),
+     CORE_REG_SPECS(R_SERIAL_NUMBER,      U16),
+     CORE_REG_SPECS(R_CLOCK_CONFIG,       U8),
+     CORE_REG_SPECS(R_TIMESTAMP_OFFSET,   U8),
+     CORE_REG_SPECS(R_UUID,               U8),
+     CORE_REG_SPECS(R_TAG,                U8),
+     CORE_REG_SPECS(R_TX_STATS,           U32),
+     CORE_REG_SPECS(R_EVENT_QUEUE_STATS,  U32),
+     CORE_REG_SPECS(R_RX_ERRORS,          U32),
+     CORE_REG_SPECS(R_SYNC_QUALITY,       S32),
+     CORE_REG_SPECS(R_SYNC_COUNTERS,      U32),
+     CORE_REG_SPECS(R_TIME_PROBE,         U64),
+     CORE_REG_SPECS(R_TIME_ADJUST,        S32),
+     CORE_REG_SPECS(R_RX_LATENCY,         U32),
     };
 
+/**
+ * \brief true if the #address_to_specs table covers every RegValues field
+ *  exactly once and in address order.
+ */
+    static constexpr bool address_to_specs_is_contiguous()
+    {
+        size_t next_offset = 0;
+        for (const CoreRegSpecs& specs: address_to_specs)
+        {
+            if (specs.offset != next_offset || specs.num_bytes == 0)
+                return false;
+            next_offset += specs.num_bytes;
+        }
+        return next_offset == sizeof(RegValues);
+    }
+
+/**
+ * \brief return the specs of the core register at the specified index.
+ * \warning index must be less than CORE_REG_COUNT. See core_reg_index().
+ */
+    RegSpecs specs(uint8_t index)
+    {
+        const CoreRegSpecs& core_specs = address_to_specs[index];
+        return {((volatile uint8_t*)&regs_) + core_specs.offset,
+                core_specs.num_bytes, core_specs.payload_type};
+    }
+
     // Syntactic Sugar. Make bitfields for certain registers easier to access.
     OperationCtrlBits& r_operation_ctrl_bits = *((OperationCtrlBits*)(&regs_.R_OPERATION_CTRL));
     ResetDefBits& r_reset_def_bits = *((ResetDefBits*)(&regs_.R_RESET_DEF));
     ClockConfigBits& r_clock_config_bits = *((ClockConfigBits*)(&regs_.R_CLOCK_CONFIG));
 };
 
+static_assert(Registers::address_to_specs_is_contiguous(),
+              "Core register specs must cover RegValues in address order.");
+
 #endif //REGISTERS_H
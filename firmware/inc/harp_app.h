@@ -0,0 +1,262 @@
+#ifndef HARP_APP_H
+#define HARP_APP_H
+#include <harp_core.h>
+#include <core_registers.h>
+#include <reg_types.h>
+#include <array>
+#include <utility> // for std::index_sequence
+#include <type_traits>
+
+/**
+ * \brief Compile-time description of one app register: the register struct
+ *  member that holds its data, plus its read and write handler functions.
+ * \details The register's size and payload type are derived from the
+ *  member's type. Arrays are sent as multiple values of the element type.
+ * Usage:
+ * \code
+ *  AppReg<&app_regs_t::test_byte>  // generic read and write.
+ *  AppReg<&app_regs_t::test_uint, &HarpCore::read_reg_generic,
+ *         &HarpCore::write_to_read_only_reg_error> // read-only.
+ * \endcode
+ */
+template <auto Member,
+          read_reg_fn ReadFn = &HarpCore::read_reg_generic,
+          write_reg_fn WriteFn = &HarpCore::write_reg_generic>
+struct AppReg
+{
+    static constexpr auto member = Member;
+    static constexpr read_reg_fn read_fn_ptr = ReadFn;
+    static constexpr write_reg_fn write_fn_ptr = WriteFn;
+};
+
+namespace harp_app_detail
+{
+// Extract the type of a register struct member from its member pointer.
+template <typename MemberPtr> struct member_traits;
+template <typename T, typename Struct>
+struct member_traits<T Struct::*>
+{
+    using type = T;
+};
+
+template <auto Member>
+using member_t = typename member_traits<decltype(Member)>::type;
+
+/**
+ * \brief derive the harp payload type of a register from its C++ type.
+ */
+template <typename FieldType>
+constexpr reg_type_t payload_type_of()
+{
+    using ElementType = std::remove_cv_t<std::remove_all_extents_t<FieldType>>;
+    static_assert(std::is_arithmetic_v<ElementType>,
+                  "App registers must be (arrays of) integers or floats.");
+    static_assert((sizeof(ElementType) == 1) || (sizeof(ElementType) == 2)
+                  || (sizeof(ElementType) == 4) || (sizeof(ElementType) == 8),
+                  "App register element size must be 1, 2, 4, or 8 bytes.");
+    if constexpr (std::is_floating_point_v<ElementType>)
+    {
+        static_assert(sizeof(ElementType) == 4,
+                      "Only 32-bit float app registers are supported.");
+        return Float;
+    }
+    else if constexpr (std::is_signed_v<ElementType>
+                       && !std::is_same_v<ElementType, char>) // strings are U8.
+        return reg_type_t(IS_SIGNED | sizeof(ElementType));
+    else
+        return reg_type_t(sizeof(ElementType));
+}
+
+/**
+ * \brief build the handler table entry for one full-range register address.
+ */
+template <typename... AppRegs>
+constexpr RegFnPair fn_pair_at(size_t address)
+{
+    constexpr RegFnPair fns[] = {{AppRegs::read_fn_ptr, AppRegs::write_fn_ptr}...};
+    return ((address >= APP_REG_START_ADDRESS)
+            && (address < APP_REG_START_ADDRESS + sizeof...(AppRegs)))?
+        fns[address - APP_REG_START_ADDRESS]:
+        RegFnPair{nullptr, nullptr};
+}
+
+/**
+ * \brief build the handler table for every possible register address such that
+ *  dispatching a message is a single lookup by its address.
+ */
+template <typename... AppRegs, size_t... Addresses>
+constexpr std::array<RegFnPair, sizeof...(Addresses)>
+make_jump_table(std::index_sequence<Addresses...>)
+{return {{fn_pair_at<AppRegs...>(Addresses)...}};}
+} // namespace harp_app_detail
+
+/**
+ * \brief Harp App that handles core behaviors in addition to reads/writes to
+ *  app-specific registers, where the app registers are described at compile
+ *  time.
+ * \details Register specs (location, size, payload type) are derived from the
+ *  register struct's members, and messages are dispatched to the handler
+ *  functions through a constexpr table indexed by register address.
+ *  Implemented as a singleton like HarpCApp.
+ * \tparam Regs the (global) app register struct instance.
+ * \tparam UpdateFn function called periodically to update the app state.
+ * \tparam ResetFn function called to reset the app state.
+ * \tparam AppRegs one AppReg per app register, in address order starting at
+ *  APP_REG_START_ADDRESS.
+ * Usage:
+ * \code
+ *  using App = HarpApp<app_regs, update_app_state, app_reset,
+ *                      AppReg<&app_regs_t::test_byte>,
+ *                      AppReg<&app_regs_t::test_uint>>;
+ *  App& app = App::init(who_am_i, ...);
+ * \endcode
+ */
+template <auto& Regs, void (*UpdateFn)(void), void (*ResetFn)(void),
+          typename... AppRegs>
+class HarpApp: public HarpCore
+{
+    static_assert(sizeof...(AppRegs) > 0, "HarpApp needs at least one register.");
+    static_assert(APP_REG_START_ADDRESS + sizeof...(AppRegs) <= 256,
+                  "Too many app registers.");
+    static_assert((DIAG_REG_START_ADDRESS < APP_REG_START_ADDRESS)
+                  || (APP_REG_START_ADDRESS + sizeof...(AppRegs)
+                      <= DIAG_REG_START_ADDRESS),
+                  "App registers overlap the diagnostic core registers.");
+
+// Make constructor private to prevent creating instances outside of init().
+private:
+    HarpApp(uint16_t who_am_i,
+            uint8_t hw_version_major, uint8_t hw_version_minor,
+            uint8_t assembly_version,
+            uint8_t harp_version_major, uint8_t harp_version_minor,
+            uint8_t fw_version_major, uint8_t fw_version_minor,
+            uint16_t serial_number, const char name[],
+            const uint8_t tag[])
+    :HarpCore(who_am_i, hw_version_major, hw_version_minor,
+              assembly_version, harp_version_major, harp_version_minor,
+              fw_version_major, fw_version_minor, serial_number, name, tag)
+    {}
+
+    ~HarpApp(){}
+
+public:
+    HarpApp() = delete;  // Disable default constructor.
+    HarpApp(HarpApp& other) = delete; // Disable copy constructor.
+    void operator=(const HarpApp& other) = delete; // Disable assignment operator.
+
+/**
+ * \brief initialize the harp app singleton with parameters and init Tinyusb.
+ */
+    static HarpApp& init(uint16_t who_am_i,
+                         uint8_t hw_version_major, uint8_t hw_version_minor,
+                         uint8_t assembly_version,
+                         uint8_t harp_version_major, uint8_t harp_version_minor,
+                         uint8_t fw_version_major, uint8_t fw_version_minor,
+                         uint16_t serial_number, const char name[],
+                         const uint8_t tag[])
+    {
+        static HarpApp app(who_am_i, hw_version_major, hw_version_minor,
+                           assembly_version,
+                           harp_version_major, harp_version_minor,
+                           fw_version_major, fw_version_minor, serial_number,
+                           name, tag);
+        return app;
+    }
+
+    static HarpApp& instance() ///< returns the singleton.
+    {return static_cast<HarpApp&>(HarpCore::instance());}
+
+    static constexpr size_t reg_count = sizeof...(AppRegs);
+
+private:
+/**
+ * \brief entry point for handling incoming harp messages to app registers.
+ *  Implements virtual member fn in base class of the same name.
+ */
+    void handle_buffered_app_message() final
+    {
+        msg_t msg = get_buffered_msg();
+        // Ignore out-of-range msgs.
+        if (!handle_app_message(msg))
+            return;
+        clear_msg();
+    }
+
+/**
+ * \brief dispatch a message to an app register to its handler function with
+ *  a single table lookup.
+ *  Implements virtual member fn in base class of the same name.
+ * \return false if the message is out of the app register range.
+ */
+    bool handle_app_message(msg_t& msg) final
+    {
+        const RegFnPair& fns = jump_table_[msg.header.address];
+        if (fns.read_fn_ptr == nullptr)
+            return false;
+        switch (msg.header.type)
+        {
+            case READ:
+                fns.read_fn_ptr(msg.header.address);
+                break;
+            case WRITE:
+                fns.write_fn_ptr(msg);
+                break;
+            default:
+                break;
+        }
+        return true;
+    }
+
+/**
+ * \brief update app state. Implements virtual member fn in base class of
+ *  the same name.
+ */
+    void update_app_state() final
+    {UpdateFn();}
+
+/**
+ * \brief Reset the app state. Implements virtual member fn in base class of
+ *  the same name.
+ */
+    void reset_app() final
+    {ResetFn();}
+
+/**
+ * \brief send one harp reply read message per app register.
+ *  Implements virtual member fn in base class of the same name.
+ */
+    void dump_app_registers() final
+    {
+        for (uint8_t address = APP_REG_START_ADDRESS;
+             address < APP_REG_START_ADDRESS + reg_count; ++address)
+            send_harp_reply(READ, address);
+    }
+
+/**
+ * \brief return app address's specs from the specified register address.
+ *  Implements virtual member fn in base class of the same name.
+ */
+    const RegSpecs& address_to_app_reg_specs(uint8_t address) final
+    {return reg_specs_[address - APP_REG_START_ADDRESS];}
+
+/**
+ * \brief app register specs, indexed by app register address. Derived from
+ *  the register struct members at compile time.
+ */
+    inline static const RegSpecs reg_specs_[reg_count] =
+    {{(volatile uint8_t*)&(Regs.*AppRegs::member),
+      sizeof(harp_app_detail::member_t<AppRegs::member>),
+      harp_app_detail::payload_type_of<
+          harp_app_detail::member_t<AppRegs::member>>()}...};
+
+/**
+ * \brief read/write handler functions indexed by full register address.
+ *  Addresses without an app register have null handlers.
+ */
+    inline static constexpr std::array<RegFnPair, 256> jump_table_
+    HARP_CORE_TABLE_ATTR =
+        harp_app_detail::make_jump_table<AppRegs...>(
+            std::make_index_sequence<256>{});
+};
+
+#endif // HARP_APP_H
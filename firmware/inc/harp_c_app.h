@@ -22,7 +22,8 @@ private:
  * \param app_register_count number of app registers
  * \param reg_fns array of RegFnPairs {read fn ptr, write fn ptr}, indexed by
  *  register address.
- * \param app_reg_count number of app registers.
+ * \param app_reg_count number of app registers. App registers must end below
+ *  DIAG_REG_START_ADDRESS, where the diagnostic core registers start.
  * \param update_fn pointer to function that will be called periodically to
  *  update the app state.
  * \param reset_fn pointer to function that will reset the app state.
@@ -69,6 +70,13 @@ private:
  */
     void handle_buffered_app_message();
 
+/**
+ * \brief dispatch a message to an app register to its handler function.
+ *  Implements virtual member fn in base class of the same name.
+ * \return false if the message is out of the app register range.
+ */
+    bool handle_app_message(msg_t& msg);
+
 /**
  * \brief update app state. Readable registers can be updated here.
  *  Implements virtual member fn in base class of the same name.
@@ -0,0 +1,143 @@
+#ifndef HARP_CLOCK_GENERATOR_H
+#define HARP_CLOCK_GENERATOR_H
+#include <stdint.h>
+#include <harp_hal.h>
+#include <harp_sync_frame.h>
+#include <harp_synchronizer.h> // for the sync uart format.
+
+#ifndef HARP_CLOCK_GEN_MIN_LEAD_US
+#define HARP_CLOCK_GEN_MIN_LEAD_US (1'000) // Skip a packet if its start edge
+                                           // is closer than this when it is
+                                           // scheduled.
+#endif
+#ifndef HARP_CLOCK_GEN_MAX_LATE_US
+#define HARP_CLOCK_GEN_MAX_LATE_US (20) // Skip a packet if its alarm fires
+                                        // further than this from its start
+                                        // edge in Harp time (i.e: if Harp
+                                        // time stepped since scheduling).
+#endif
+
+// Generator that sends the Harp clock sync packets on a uart so that other
+// devices can synchronize to this device's Harp time. Singleton.
+// One packet is sent per Harp second, timed per the protocol (see
+//  harp_sync_frame.h) such that a HarpSynchronizer timestamping it by its
+//  start edge reads back our Harp time.
+// Packets are queued into the uart's tx FIFO from a hardware alarm callback,
+//  so sending them costs one interrupt per second and no polling.
+// The alarm is set in system time. Whenever Harp time changes, remap()
+//  converts the scheduled packet's start edge again. HarpCore does this when
+//  the generator is attached with HarpCore::set_clock_generator().
+class HarpClockGenerator
+{
+private:
+    // Make constructor/destructor private.
+    HarpClockGenerator(uart_inst_t* uart_id, uint8_t uart_tx_pin);
+    ~HarpClockGenerator();
+public:
+    // Disable default constructor, copy constructor, and assignment operator.
+    HarpClockGenerator() = delete;
+    HarpClockGenerator(HarpClockGenerator& other) = delete;
+    void operator=(const HarpClockGenerator& other) = delete;
+
+/**
+ * \brief init the HarpClockGenerator singleton and return a reference to it.
+ */
+    static HarpClockGenerator& init(uart_inst_t* uart, uint8_t uart_tx_pin);
+
+/**
+ * \brief return a pointer to the one-and-only instance or nullptr if
+ *      init() was never called.
+ */
+    static HarpClockGenerator& instance(){return *self;}
+
+/**
+ * \brief false if the generator could not claim a hardware alarm and cannot
+ *  run.
+ */
+    static inline bool is_available()
+    {return self->alarm_num_ >= 0;}
+
+/**
+ * \brief set the Harp time that packets follow, i.e: HarpCore's time.
+ * \details must be set before start(). Both conversions must be safe to call
+ *  from an interrupt.
+ */
+    static inline void set_time_source(
+        uint64_t (*system_to_harp_us_64)(uint64_t system_time_us),
+        uint64_t (*harp_to_system_us_64)(uint64_t harp_time_us))
+    {
+        self->system_to_harp_us_64_ = system_to_harp_us_64;
+        self->harp_to_system_us_64_ = harp_to_system_us_64;
+    }
+
+/**
+ * \brief start sending one sync packet per Harp second, beginning with the
+ *  next second that can be announced in time.
+ */
+    static void start();
+
+/**
+ * \brief stop sending sync packets. A packet that is already being sent
+ *  finishes.
+ */
+    static void stop();
+
+    static inline bool is_running()
+    {return self->running_;}
+
+/**
+ * \brief set the alarm for the scheduled packet again from its Harp time.
+ *  Call whenever Harp time changes.
+ * \details If Harp time stepped such that the packet can no longer be sent
+ *  in time (or is more than a second away), the next packet that can be
+ *  sent in time is scheduled instead. Safe to call from an interrupt.
+ */
+    static void remap();
+
+/**
+ * \brief number of sync packets sent since init().
+ */
+    static inline uint32_t packets_sent()
+    {return self->packets_sent_;}
+
+/**
+ * \brief number of sync packets skipped because their alarm fired too late
+ *  or Harp time changed after they were scheduled.
+ */
+    static inline uint32_t packets_skipped()
+    {return self->packets_skipped_;}
+
+private:
+/**
+ * \brief a pointer to the one-and-only instance or nullptr if init() was
+ *      never called.
+ */
+    static inline HarpClockGenerator* self = nullptr;
+
+/**
+ * \brief Callback fn for the alarm that fires on each packet's start edge.
+ * \note Interrupt callbacks must be static, so this fn refers use the self ptr
+ *      to access the singleton data members.
+ */
+    static void alarm_callback(unsigned int alarm_num);
+
+/**
+ * \brief set the alarm for the start edge of the next packet that can still
+ *  be sent in time.
+ */
+    void schedule_next_packet();
+
+    uart_inst_t* uart_id_;
+    int alarm_num_; ///< -1 if no alarm was free.
+    uint64_t (*system_to_harp_us_64_)(uint64_t system_time_us);
+    uint64_t (*harp_to_system_us_64_)(uint64_t harp_time_us);
+
+    // members edited within an ISR must be volatile.
+
+    volatile bool running_;
+    uint32_t encoded_seconds_; ///< content of the scheduled packet.
+    volatile uint32_t packets_sent_;
+    volatile uint32_t packets_skipped_;
+};
+
+#endif // HARP_CLOCK_GENERATOR_H
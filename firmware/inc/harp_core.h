@@ -4,23 +4,59 @@
 #include <harp_message.h>
 #include <core_registers.h>
 #include <harp_synchronizer.h>
+#include <harp_clock_generator.h>
+#include <harp_event_queue.h>
+#include <harp_timestamp_encoder.h>
+#include <harp_scheduler.h>
 #include <arm_regs.h>
 #include <cstring> // for memcpy
-#include <tusb.h>
-
-// Pico-specific includes.
-#include <hardware/structs/timer.h>
-#include <pico/divider.h> // for fast hardware division with remainder.
-#include <hardware/timer.h>
-#include <pico/unique_id.h>
-#include <pico/bootrom.h>
+#include <harp_hal.h> // for clock, usb, and chip-specific functions.
 
 #define NO_PC_INTERVAL_US (3'000'000UL) // Threshold duration. If the connection
                                         // with the PC has been inactive for
                                         // this duration, op mode should switch
                                         // to IDLE.
-#define HEARTBEAT_ACTIVE_INTERVAL_US (1'000'000UL)
-#define HEARTBEAT_STANDBY_INTERVAL_US (3'000'000UL)
+#define HEARTBEAT_ACTIVE_INTERVAL_US (1'000'000UL) // Must be whole seconds.
+#define HEARTBEAT_STANDBY_INTERVAL_US (3'000'000UL) // Must be whole seconds.
+#define TX_COALESCE_DEADLINE_US (250UL) // Default max time a queued message
+                                        // waits for a usb packet to fill up
+                                        // when coalescing.
+#ifndef HARP_CORE1_QUEUE_SIZE
+#define HARP_CORE1_QUEUE_SIZE (8) // Max number of messages pending between
+                                  // cores in dual-core mode. Must be a power
+                                  // of 2.
+#endif
+#ifndef HARP_CORE1_MAX_PAYLOAD_SIZE
+#define HARP_CORE1_MAX_PAYLOAD_SIZE (64) // Largest message payload (in bytes)
+                                         // passed between cores in dual-core
+                                         // mode.
+#endif
+#ifndef RX_BUFFER_SIZE
+#define RX_BUFFER_SIZE (512) // Must fit at least one max-size harp message.
+#endif
+#define RX_PARTIAL_MSG_TIMEOUT_US (50'000UL) // Discard a partial message if
+                                            // no new bytes arrive for this
+                                            // long.
+#define RX_MSG_BUDGET (16)   // Default max number of incoming messages handled
+                             // per run() call.
+#ifndef RX_ARRIVAL_SLOTS
+#define RX_ARRIVAL_SLOTS (8) // Max number of serial port reads whose arrival
+                             // times are kept for unhandled bytes.
+#endif
+#define TX_FIFO_FULL_TIMEOUT_US (10'000UL) // Max time to wait for room in the
+                                           // usb tx FIFO before dropping an
+                                           // outgoing frame.
+#define TIMESTAMP_OFFSET_STEP_US (500UL) // Resolution of R_TIMESTAMP_OFFSET
+                                         // per the harp protocol spec.
+#ifndef HARP_EVENT_LATENCY_SOURCES
+#define HARP_EVENT_LATENCY_SOURCES (8) // Max number of registers with an
+                                       // event latency. See
+                                       // set_event_latency_us().
+#endif
+#ifndef HARP_IDLE_MAX_SLEEP_US
+#define HARP_IDLE_MAX_SLEEP_US (10'000UL) // Longest that run() sleeps with
+                                          // the IDLE_SLEEP policy.
+#endif
 
 // Create a typedef to simplify syntax for array of static function ptrs.
 typedef void (*read_reg_fn)(uint8_t reg);
@@ -34,6 +70,42 @@ struct RegFnPair
     write_reg_fn  write_fn_ptr;
 };
 
+/**
+ * \brief enum for specifying when outgoing harp messages queued in the usb tx
+ *  FIFO are pushed to the PC.
+ * \details FLUSH_PER_MSG sends a usb packet after every reply (lowest latency
+ *  per message but one usb packet per message). FLUSH_PER_RUN sends queued
+ *  messages once per run() iteration such that bursts of replies (i.e: a
+ *  register DUMP) share usb packets. FLUSH_COALESCE packs messages across
+ *  run() iterations into full usb packets and only sends a partially-filled
+ *  packet once its oldest message has waited for the coalescing deadline.
+ * \note Regardless of policy, tinyusb sends a full usb packet as soon as one
+ *  is available.
+ */
+enum tx_flush_policy_t: uint8_t
+{
+    FLUSH_PER_MSG = 0,
+    FLUSH_PER_RUN = 1,
+    FLUSH_COALESCE = 2
+};
+
+/**
+ * \brief enum for specifying what run() does once it has nothing left to do.
+ * \details IDLE_POLL returns right away such that the main loop polls usb,
+ *  the clock, and the app continuously. IDLE_SLEEP puts the core to sleep
+ *  (`__wfe()`) until any interrupt (i.e: usb, sync packets, the heartbeat
+ *  and scheduler alarms, or the app's own), an event from the other core,
+ *  or the next timeout, and then returns.
+ * \note with IDLE_SLEEP, update_app_state() only runs after an interrupt or
+ *  at least every `HARP_IDLE_MAX_SLEEP_US`, so apps that poll hardware
+ *  without interrupts should keep IDLE_POLL.
+ */
+enum idle_policy_t: uint8_t
+{
+    IDLE_POLL = 0,
+    IDLE_SLEEP = 1
+};
+
 /**
  * \brief Harp Core that handles management of common bank registers.
 *       Implemented as a singleton to simplify attaching interrupt callbacks
@@ -77,17 +149,32 @@ public:
 
 /**
  * \brief Periodically handle tasks based on the current time, state,
- *      and inputs. Should be called in a loop. Calls tud_task() and
- *      process_cdc_input().
+ *      and inputs. Should be called in a loop. Calls hal_cdc_task() and
+ *      process_cdc_input(), handles every complete incoming message (up to
+ *      the rx message budget), and pushes queued replies to the PC if the
+ *      flush policy is FLUSH_PER_RUN. With the IDLE_SLEEP policy, first
+ *      sleeps until there is something to do.
  */
     void run();
 
+/**
+ * \brief Run the app on core1 and keep usb, message parsing, core registers,
+ *  and outgoing messages on core0 (dual-core mode).
+ * \details After this call, run() must still be called in a loop on core0,
+ *  and core1 repeatedly calls update_app_state() and handles app register
+ *  messages forwarded from core0. Replies and events sent from core1 are
+ *  queued and sent by core0.
+ * \warning must be called from core0, once, before calling run(). See
+ *  notes/design_notes.md for the register access rules in dual-core mode.
+ */
+    static void launch_app_on_core1();
+
 /**
  * \brief return a reference to the message header in the #rx_buffer_.
  * \warning this should only be accessed if new_msg() is true.
  */
     msg_header_t& get_buffered_msg_header()
-    {return *((msg_header_t*)(&rx_buffer_));}
+    {return *((msg_header_t*)(rx_buffer_ + rx_read_index_));}
 
 /**
  * \brief return a reference to the message in the #rx_buffer_. Inline.
@@ -108,7 +195,9 @@ public:
 
 /**
  * \brief flag that new message has been handled. Inline.
- * \note Does not affect internal behavior.
+ * \note run() removes handled messages from the #rx_buffer_. Messages that
+ *  are not cleared stay in the buffer and are handled again on the next
+ *  run() call.
  */
     void clear_msg()
     {new_msg_ = false;}
@@ -150,12 +239,28 @@ public:
         memcpy((void*)specs.base_ptr, msg.payload, specs.num_bytes);
     }
 
+/**
+ * \brief Serialize a Harp-compliant timestamped message into a contiguous
+ *  buffer, computing the checksum in the same pass.
+ * \param frame buffer of at least `MAX_TIMESTAMPED_MSG_SIZE` bytes.
+ * \param harp_time_us the timestamp, written as is (i.e: already
+ *  compensated).
+ * \return the total number of bytes written to the frame.
+ */
+    static uint16_t build_harp_frame(uint8_t* frame, msg_type_t reply_type,
+                                     uint8_t reg_name,
+                                     const volatile uint8_t* data,
+                                     uint8_t num_bytes,
+                                     reg_type_t payload_type,
+                                     uint64_t harp_time_us);
+
 /**
  * \brief Construct and send a Harp-compliant timestamped reply message from
  *  provided arguments.
  * \note this function is static such that we can write functions that invoke it
  *  before instantiating the HarpCore singleton.
- * \note Calls `tud_task()`.
+ * \note The reply is queued as a single frame and sent according to the
+ *  flush policy. See set_tx_flush_policy().
  * \param reply_type `READ`, `WRITE`, `EVENT`, `READ_ERROR`, or `WRITE_ERROR` enum.
  * \param reg_name address to mark the origin point of the data.
  * \param data pointer to payload content of the data.
@@ -174,7 +279,8 @@ public:
  *  function is called.
  * \note this function is static such that we can write functions that invoke it
  *  before instantiating the HarpCore singleton.
- * \note Calls `tud_task()`.
+ * \note The reply is queued as a single frame and sent according to the
+ *  flush policy. See set_tx_flush_policy().
  * \param reply_type `READ`, `WRITE`, `EVENT`, `READ_ERROR`, or `WRITE_ERROR` enum.
  * \param reg_name address to mark the origin point of the data.
  * \param data pointer to payload content of the data.
@@ -195,7 +301,8 @@ public:
  *  specs for the provided address and construct a reply based on those specs.
  * \note this function is static such that we can write functions that invoke it
  *  before instantiating the HarpCore singleton.
- * \note Calls `tud_task()`.
+ * \note The reply is queued as a single frame and sent according to the
+ *  flush policy. See set_tx_flush_policy().
  * \param reply_type `READ`, `WRITE`, `EVENT`, `READ_ERROR`, or `WRITE_ERROR` enum.
  * \param reg_name address to mark the origin point of the data.
  */
@@ -210,7 +317,8 @@ public:
  * \brief Send a Harp-compliant reply with a specific timestamp.
  * \note this function is static such that we can write functions that invoke it
  *  before instantiating the HarpCore singleton.
- * \note Calls `tud_task()`.
+ * \note The reply is queued as a single frame and sent according to the
+ *  flush policy. See set_tx_flush_policy().
  * \param reply_type `READ`, `WRITE`, `EVENT`, `READ_ERROR`, or `WRITE_ERROR` enum.
  * \param reg_name address to mark the origin point of the data.
  * \param harp_time_us the harp time (in microseconds) to timestamp onto the
@@ -226,6 +334,77 @@ public:
 
 
 
+/**
+ * \brief Queue a pre-timestamped EVENT message to be sent from run().
+ * \details Safe to call from an interrupt handler (i.e: GPIO, PIO, or timer
+ *  interrupts) since it does not touch tinyusb or the timestamp registers.
+ *  The payload is copied, so \p data may change after this call returns.
+ * \warning events may be posted from only one interrupt context (or several
+ *  that cannot preempt each other). See EventQueue. Interrupts that need to
+ *  post events from another context must use their own queue (see the
+ *  overload below).
+ * \note events are discarded when sent if events are not enabled.
+ * \param reg_name address to mark the origin point of the data.
+ * \param data pointer to payload content of the data.
+ * \param num_bytes `sizeof(data)`. At most `HARP_EVENT_MAX_PAYLOAD_SIZE`.
+ * \param payload_type `U8`, `S8`, `U16`, `U32`, `U64`, `S64`, or `Float` enum.
+ * \param harp_time_us the harp time (in microseconds) to timestamp onto the
+ *  outgoing message.
+ * \return true if the event was queued. False if it was dropped.
+ */
+    static inline bool post_event_from_isr(uint8_t reg_name,
+                                           const volatile uint8_t* data,
+                                           uint8_t num_bytes,
+                                           reg_type_t payload_type,
+                                           uint64_t harp_time_us)
+    {
+        bool queued = self->event_queue_.push(EVENT, reg_name, data,
+                                              num_bytes, payload_type,
+                                              harp_time_us);
+        // Returning from the interrupt wakes this core, but not the other.
+        wake();
+        return queued;
+    }
+
+/**
+ * \brief Queue a pre-timestamped EVENT message where payload data is copied
+ *  from the specified register.
+ * \details see the overload above.
+ */
+    static inline bool post_event_from_isr(uint8_t reg_name,
+                                           uint64_t harp_time_us)
+    {return post_event_from_isr(self->event_queue_, reg_name, harp_time_us);}
+
+/**
+ * \brief Queue a pre-timestamped EVENT message where payload data is copied
+ *  from the specified register into \p queue instead of the core's queue.
+ * \details for interrupts that cannot share the core's queue with the app's
+ *  interrupts (i.e: the scheduler's alarm). The caller is the only producer
+ *  for \p queue, and \p queue must be drained by send_queued_events().
+ */
+    template <size_t N, size_t PayloadSize>
+    static inline bool post_event_from_isr(EventQueue<N, PayloadSize>& queue,
+                                           uint8_t reg_name,
+                                           uint64_t harp_time_us)
+    {
+        const RegSpecs& specs = self->reg_address_to_specs(reg_name);
+        bool queued = queue.push(EVENT, reg_name, specs.base_ptr,
+                                 specs.num_bytes, specs.payload_type,
+                                 harp_time_us);
+        // Returning from the interrupt wakes this core, but not the other.
+        wake();
+        return queued;
+    }
+
+/**
+ * \brief Queue an EVENT message where payload data is copied from the
+ *  specified register and the timestamp is taken at the time this function is
+ *  called.
+ * \details see the overloads above.
+ */
+    static inline bool post_event_from_isr(uint8_t reg_name)
+    {return post_event_from_isr(reg_name, harp_time_us_64());}
+
 /**
  * \brief true if the mute flag has been set in the R_OPERATION_CTRL register.
  */
@@ -234,10 +413,11 @@ public:
 
 /**
  * \brief true if the device is synchronized via external CLKIN input.
- * \details true if the device has received and handled at least one
- *  synchronization signal from its external CLKIN input. As implemented, this
- *  function will never return false after synchronizing at least once, but
- *  that may change later.
+ * \details true if the device has received a synchronization signal from its
+ *  external CLKIN input within the synchronizer's timeout (see
+ *  HarpSynchronizer::set_sync_timeout_us()). Changes in lock state are
+ *  reported in the CLK_LOCK and CLK_UNLOCK bits of R_CLOCK_CONFIG and with an
+ *  EVENT from that register.
  */
     static inline bool is_synced()
     {
@@ -262,7 +442,17 @@ public:
  *  class instance has configured a synchronizer with set_synchronizer().
  */
     static inline uint64_t harp_time_us_64()
-    {return system_to_harp_us_64(time_us_64());}
+    {return system_to_harp_us_64(hal_time_us_64());}
+
+/**
+ * \brief get the lower 32 bits of the elapsed microseconds in "Harp" time.
+ * \details faster than truncating harp_time_us_64().
+ * \warning see harp_time_us_64().
+ */
+    static inline uint32_t harp_time_us_32()
+    {return (self->sync_ == nullptr)?
+                hal_time_us_32() - uint32_t(self->offset_us_64_):
+                self->sync_->time_us_32();}
 
 /**
  * \brief get the current elapsed seconds in "Harp" time.
@@ -270,10 +460,7 @@ public:
  *  has elapsed.
  */
     static inline uint32_t harp_time_s()
-    {
-        self->update_timestamp_regs(); // calls harp_time_us_64() internally.
-        return self->regs.R_TIMESTAMP_SECOND;
-    }
+    {return uint32_t(hal_div_u64u64(harp_time_us_64(), 1'000'000ULL));}
 
 /**
  * \brief convert harp time (in 64-bit microseconds) to local system time
@@ -330,15 +517,108 @@ public:
     static inline void set_harp_time_us_64(uint64_t harp_time_us)
     {if (self->sync_ != nullptr)
         self->sync_->set_harp_time_us_64(harp_time_us);
-     self->offset_us_64_ = time_us_64() - harp_time_us;}
+     self->offset_us_64_ = hal_time_us_64() - harp_time_us;
+     clock_changed();}
 
 /**
  * \brief attach a synchronizer. If the synchronizer is attached, then calls to
  *  harp_time_us_64() and harp_time_us_32() will reflect the synchronizer's
  *  time.
  */
-    static void set_synchronizer(HarpSynchronizer* sync)
-    {self->sync_ = sync;}
+    static void set_synchronizer(HarpSynchronizer* sync);
+
+/**
+ * \brief attach a clock generator. If the generator is available, GEN_ABLE is
+ *  set in R_CLOCK_CONFIG, and the PC can make this device a Harp clock source
+ *  by setting CLK_GEN. While generating, the synchronizer (if any) is
+ *  ignored, and the generator sends this device's Harp time.
+ *  With a synchronizer also attached, REP_ABLE is set too, and setting
+ *  CLK_REP makes the generator repeat the synchronized Harp time while the
+ *  synchronizer is locked.
+ */
+    static void set_clock_generator(HarpClockGenerator* clock_gen);
+
+/**
+ * \brief attach a scheduler to run actions at Harp times. Its deadlines
+ *  follow this core's Harp time, including sync corrections and writes to
+ *  the timestamp registers.
+ */
+    static void set_scheduler(HarpScheduler* scheduler);
+
+/**
+ * \brief compensate EVENTs from a register for a known, fixed latency
+ *  between what they report happening and the time they are timestamped
+ *  (i.e: sensor conversion time, debounce time, or PIO pipeline depth).
+ * \details the latency is subtracted from the timestamp of every EVENT sent
+ *  from \p reg_name, on top of the offset in R_TIMESTAMP_OFFSET, so that
+ *  apps can timestamp events when they are handled. Replies to reads and
+ *  writes are not compensated.
+ * \param latency_us the latency to subtract. 0 removes the register's
+ *  compensation.
+ * \return false if the table of compensated registers
+ *  (`HARP_EVENT_LATENCY_SOURCES` long) is full.
+ */
+    static bool set_event_latency_us(uint8_t reg_name, uint32_t latency_us);
+
+/**
+ * \brief the latency subtracted from EVENTs sent from \p reg_name, or 0.
+ */
+    static uint32_t event_latency_us(uint8_t reg_name);
+
+/**
+ * \brief set the max number of incoming messages handled per run() call.
+ * \details defaults to `RX_MSG_BUDGET`. Lower values bound the time spent
+ *  in one run() call when the PC sends a burst of messages.
+ */
+    static void set_rx_msg_budget(uint8_t budget)
+    {self->rx_msg_budget_ = budget;}
+
+/**
+ * \brief specify when queued outgoing messages are pushed to the PC.
+ * \details defaults to FLUSH_PER_RUN.
+ */
+    static void set_tx_flush_policy(tx_flush_policy_t policy)
+    {self->tx_flush_policy_ = policy;}
+
+/**
+ * \brief specify what run() does once it has nothing left to do.
+ * \details defaults to IDLE_POLL.
+ */
+    static void set_idle_policy(idle_policy_t policy)
+    {self->idle_policy_ = policy;}
+
+/**
+ * \brief wake core0 if run() is sleeping with the IDLE_SLEEP policy.
+ * \details interrupts on core0 wake it by themselves. Call this after
+ *  handing core0 work from core1 (or from an interrupt on core1), or from
+ *  code that runs outside of interrupts.
+ * \note safe to call from either core and from interrupts.
+ */
+    static inline void wake()
+    {hal_send_event();}
+
+/**
+ * \brief set the maximum time (in microseconds) that a queued message may
+ *  wait for its usb packet to fill before it is sent anyway.
+ * \details only used with the FLUSH_COALESCE policy. Defaults to
+ *  `TX_COALESCE_DEADLINE_US`.
+ */
+    static void set_tx_coalesce_deadline_us(uint32_t deadline_us)
+    {self->tx_coalesce_deadline_us_ = deadline_us;}
+
+/**
+ * \brief outgoing usb traffic counters. Also readable from the `R_TX_STATS`
+ *  register.
+ */
+    static const volatile TxStats& tx_stats()
+    {return self->regs.R_TX_STATS;}
+
+/**
+ * \brief time that incoming messages waited between their arrival and being
+ *  dispatched. Also readable from the `R_RX_LATENCY` register.
+ */
+    static const volatile RxLatency& rx_latency()
+    {return self->regs.R_RX_LATENCY;}
 
 /**
  * \brief attach a callback function to control external visual indicators
@@ -383,6 +663,14 @@ protected:
  */
     virtual void handle_buffered_app_message(){};
 
+/**
+ * \brief Handle an incoming message to an app register. Used in dual-core
+ *  mode. Does nothing here, but not pure virtual since we need to be able
+ *  to instantiate a standalone harp core.
+ * \return true if the message was handled.
+ */
+    virtual bool handle_app_message(msg_t& /*msg*/){return false;};
+
 /**
  * \brief update state of the derived class. Does nothing in the base class,
  *  but not pure virtual since we need to be able to instantiate a standalone
@@ -413,7 +701,12 @@ protected:
     virtual void dump_app_registers(){};
 
     virtual const RegSpecs& address_to_app_reg_specs(uint8_t address)
-    {return regs_.address_to_specs[0];} // should never happen.
+    {return null_reg_specs_;} // should never happen.
+
+/**
+ * \brief empty specs returned for app addresses if there is no app.
+ */
+    inline static const RegSpecs null_reg_specs_{nullptr, 0, U8};
 
 /**
  * \brief flag indicating whether or not a new message is in the #rx_buffer_.
@@ -430,22 +723,43 @@ protected:
  */
     HarpSynchronizer* sync_;
 
+/**
+ * \brief the synchronizer set aside while generating the clock, or nullptr.
+ */
+    HarpSynchronizer* sync_input_;
+
+/**
+ * \brief pointer to the clock generator if configured.
+ */
+    HarpClockGenerator* clock_gen_;
+
+/**
+ * \brief pointer to the scheduler if configured.
+ */
+    HarpScheduler* scheduler_;
+
 private:
 /**
- * \brief the total number of bytes read into the the msg receive buffer.
- *  This is implemented as a read-only reference to the #rx_buffer_index_.
+ * \brief buffer to contain data read from the serial port. Holds several
+ *  messages back-to-back. Messages are handled in place.
  */
-    const uint8_t& total_bytes_read_;
+    uint8_t rx_buffer_[RX_BUFFER_SIZE];
 
 /**
- * \brief buffer to contain data read from the serial port.
+ * \brief #rx_buffer_ index of the first byte of the oldest unhandled
+ *  message.
  */
-    uint8_t rx_buffer_[MAX_PACKET_SIZE];
+    uint16_t rx_read_index_;
 
 /**
  * \brief #rx_buffer_ index where the next incoming byte will be written.
  */
-    uint8_t rx_buffer_index_;
+    uint16_t rx_write_index_;
+
+/**
+ * \brief max number of messages handled per run() call.
+ */
+    uint8_t rx_msg_budget_;
 
 /**
  * \brief local offset from "Harp time" to device hardware timer tracing
@@ -457,16 +771,63 @@ private:
     uint64_t offset_us_64_;
 
 /**
- * \brief next time a heartbeat message is scheduled to issue.
- * \note only valid if Op Mode is in the ACTIVE state.
+ * \brief time (in microseconds) subtracted from all outgoing timestamps.
+ *  Set from R_TIMESTAMP_OFFSET.
+ */
+    uint32_t timestamp_offset_us_;
+
+/**
+ * \brief encoder for the timestamps of outgoing messages and of the
+ *  timestamp registers.
+ * \note only used from core0.
+ */
+    TimestampEncoder timestamp_encoder_;
+
+/**
+ * \brief a register whose EVENTs are compensated for a fixed latency.
+ */
+    struct event_latency_t
+    {
+        uint8_t reg_name;
+        uint32_t latency_us;
+    };
+
+/**
+ * \brief latency compensation per event source. Only the first
+ *  #event_latency_count_ entries are valid.
+ */
+    event_latency_t event_latencies_[HARP_EVENT_LATENCY_SOURCES];
+    uint8_t event_latency_count_;
+
+/**
+ * \brief hardware alarm that issues heartbeats, or -1 if none was free, in
+ *  which case update_state() polls for them instead.
+ */
+    int heartbeat_alarm_num_;
+
+/**
+ * \brief the whole Harp second at which the next heartbeat is issued.
+ */
+    volatile uint32_t next_heartbeat_s_;
+
+/**
+ * \brief the current interval (in whole seconds) at which
+ *  #next_heartbeat_s_ is advanced.
  */
-    uint32_t next_heartbeat_time_us_;
+    volatile uint32_t heartbeat_interval_s_;
 
 /**
- * \brief the current interval at which the \p next_neartbeat_time_us_ is being
- * updated.
+ * \brief true if the heartbeat alarm issued a heartbeat that run() has not
+ *  sent yet. The alarm hands heartbeats to run() through this slot rather
+ *  than the #event_queue_, which has only one producer: the app's interrupts.
  */
-    uint32_t heartbeat_interval_us_;
+    volatile bool heartbeat_pending_;
+
+/**
+ * \brief the whole Harp second of the pending heartbeat.
+ * \note only valid if #heartbeat_pending_ is set.
+ */
+    volatile uint32_t pending_heartbeat_s_;
 
 /**
  * \brief last time device detects no connection with the PC in microseconds.
@@ -487,18 +848,183 @@ private:
     bool connect_handled_;
 
 /**
- * \brief true if the device has synchronized and all consequential activity
- *  has been handled.
+ * \brief the sync lock state as of the last update_state(), such that lock
+ *  changes (and their consequential activity) are handled once.
  */
     bool sync_handled_;
 
 /**
- * \brief Read incoming bytes from the USB serial port. Does not block.
- *  \warning If called again before handling previous message in the buffer, the
- *      buffered message may be be overwritten if a new message has arrived.
+ * \brief when queued outgoing messages are pushed to the PC.
+ */
+    tx_flush_policy_t tx_flush_policy_;
+
+/**
+ * \brief max time that queued messages wait for a full usb packet when
+ *  coalescing.
+ */
+    uint32_t tx_coalesce_deadline_us_;
+
+/**
+ * \brief time that the oldest message in the partially-filled usb packet was
+ *  queued.
+ * \note only valid if #tx_pending_bytes_ is nonzero.
+ */
+    uint32_t tx_pending_start_time_us_;
+
+/**
+ * \brief number of bytes queued in the current partially-filled usb packet.
+ */
+    uint8_t tx_pending_bytes_;
+
+/**
+ * \brief push the partially-filled usb packet (if any) to the PC.
+ */
+    void flush_tx();
+
+/**
+ * \brief what run() does once it has nothing left to do.
+ */
+    idle_policy_t idle_policy_;
+
+/**
+ * \brief true if the last run() call handled as many messages as its budget
+ *  allows, such that more may be waiting in the #rx_buffer_.
+ */
+    bool rx_budget_spent_;
+
+/**
+ * \brief sleep until an interrupt, an event from core1, or the next
+ *  timeout that run() polls for (i.e: for a partial incoming message, or for
+ *  coalescing outgoing messages), at most `HARP_IDLE_MAX_SLEEP_US` away.
+ *  Returns right away if work is already waiting.
+ */
+    void sleep_until_work();
+
+/**
+ * \brief events posted from interrupt context, waiting to be sent.
+ */
+    EventQueue<HARP_EVENT_QUEUE_SIZE> event_queue_;
+
+/**
+ * \brief send the pending heartbeat and all events in the #event_queue_ and
+ *  the scheduler's queue as harp EVENT messages, and all replies queued from
+ *  core1 in dual-core mode.
+ */
+    void send_queued_events();
+
+/**
+ * \brief true if the app runs on core1. See launch_app_on_core1().
+ */
+    bool app_on_core1_;
+
+/**
+ * \brief app register messages passed from core0 to core1.
+ */
+    EventQueue<HARP_CORE1_QUEUE_SIZE, HARP_CORE1_MAX_PAYLOAD_SIZE> core1_rx_queue_;
+
+/**
+ * \brief replies and events passed from core1 to core0 to be sent.
+ */
+    EventQueue<HARP_CORE1_QUEUE_SIZE, HARP_CORE1_MAX_PAYLOAD_SIZE> core1_tx_queue_;
+
+/**
+ * \brief set by core0 to request that core1 resets the app.
+ */
+    std::atomic<bool> core1_reset_pending_;
+
+/**
+ * \brief core1 entry point in dual-core mode.
+ */
+    static void core1_main();
+
+/**
+ * \brief Periodically update the app and handle app messages on core1.
+ */
+    void run_core1();
+
+/**
+ * \brief pass the app message in the #rx_buffer_ to core1 and clear it.
+ * \details leaves the message in the #rx_buffer_ if the queue to core1 is
+ *  full.
+ */
+    void forward_buffered_app_message();
+
+/**
+ * \brief dispatch the message in the #rx_buffer_ to the core or app handlers
+ *  and clear it.
+ */
+    void handle_buffered_message();
+
+/**
+ * \brief Commit a fully-formed frame to the usb tx FIFO in one write.
+ * \details waits (up to `TX_FIFO_FULL_TIMEOUT_US`) for room in the FIFO
+ *  so that frames are never split. Frames that do not fit are dropped.
+ *  Updates the `R_TX_STATS` register.
+ */
+    void write_frame(const uint8_t* frame, uint16_t frame_size);
+
+/**
+ * \brief Read all incoming bytes from the USB serial port that fit in the
+ *  #rx_buffer_. Does not block.
+ * \details Unhandled messages in the #rx_buffer_ are preserved but may be
+ *  moved, so references to the buffered message are invalidated.
  */
     void process_cdc_input();
 
+/**
+ * \brief set #new_msg_ if a complete message starts at the #rx_read_index_.
+ * \details Skips bytes (one at a time) that cannot start a message, complete
+ *  messages with a bad checksum, and partial messages that have not
+ *  completed within `RX_PARTIAL_MSG_TIMEOUT_US` until the buffer starts
+ *  with a plausible message header. Updates the `R_RX_ERRORS` register.
+ * \return true if a complete message is buffered.
+ */
+    bool buffer_next_msg();
+
+/**
+ * \brief time that the most recent byte was read from the serial port.
+ */
+    uint32_t rx_last_byte_time_us_;
+
+/**
+ * \brief bytes of the #rx_buffer_ delivered by one serial port read.
+ */
+    struct rx_arrival_t
+    {
+        uint16_t end_index; ///< #rx_buffer_ index just past the read's bytes.
+        uint32_t time_us;   ///< system time of the read.
+        uint64_t harp_time_us; ///< the same time in Harp time.
+    };
+
+/**
+ * \brief the reads that delivered the unhandled bytes in the #rx_buffer_,
+ *  oldest first. Only the first #rx_arrival_count_ entries are valid. If
+ *  there are more reads than slots, the oldest ones are merged into the next
+ *  oldest, so arrival times are never earlier than the real ones.
+ */
+    rx_arrival_t rx_arrivals_[RX_ARRIVAL_SLOTS];
+    uint8_t rx_arrival_count_;
+
+/**
+ * \brief system time that the last byte of the buffered message was read
+ *  from the serial port, and the same time in Harp time. Set by
+ *  buffer_next_msg().
+ */
+    uint32_t rx_msg_time_us_;
+    uint64_t rx_msg_harp_time_us_;
+
+/**
+ * \brief add the time that the buffered message waited since its arrival to
+ *  the `R_RX_LATENCY` register.
+ */
+    void record_rx_latency(uint32_t wait_us);
+
+/**
+ * \brief true while skipping bytes to find the start of the next message.
+ *  Used so that each corrupted stretch of bytes counts as one error.
+ */
+    bool rx_resyncing_;
+
 /**
  * \brief update internal state machine.
  * \param force. If true, the state will change to the #forced_next_state.
@@ -512,24 +1038,26 @@ private:
 
 /**
  * \brief Write the current Harp time to the timestamp registers.
- * \warning must be called before timestamp registers are read.
+ * \warning must be called before timestamp registers are read. Outgoing
+ *  message timestamps are encoded without them.
  */
     static inline void update_timestamp_regs()
     {return set_timestamp_regs(harp_time_us_64());}
 
 
 /**
- * \brief Write the a specified Harp time to the timestamp registers.
+ * \brief Write the a specified Harp time, less the offset in
+ *  R_TIMESTAMP_OFFSET, to the timestamp registers.
  */
     static void set_timestamp_regs(uint64_t harp_time_us);
 
 /**
- * \brief return a reference to the specified core or app register's specs used
- *  for issuing a harp reply for that register.
+ * \brief return the specified core or app register's specs used for issuing
+ *  a harp reply for that register.
  * \details address	is the full address range where 0 is the first core
  *  register, and APP_REG_START_ADDRESS is the first app register.
  */
-    const RegSpecs& reg_address_to_specs(uint8_t address);
+    RegSpecs reg_address_to_specs(uint8_t address);
 
     // core register read handler functions. Handles read operations on those
     // registers. One-per-harp-register where necessary, but read_reg_generic()
@@ -538,6 +1066,16 @@ private:
     static void read_timestamp_second(uint8_t reg_name);
     static void read_timestamp_microsecond(uint8_t reg_name);
 
+/**
+ * \brief update the timestamp registers and send a reply from one of them,
+ *  timestamped at the same Harp time.
+ */
+    static void send_timestamp_reg_reply(msg_type_t reply_type,
+                                         uint8_t reg_name);
+    static void read_event_queue_stats(uint8_t reg_name);
+    static void read_sync_quality(uint8_t reg_name);
+    static void read_sync_counters(uint8_t reg_name);
+
 
     // write handler function per core register. Handles write
     // operations to that register.
@@ -560,15 +1098,101 @@ private:
     static void write_device_name(msg_t& msg);
     static void write_serial_number(msg_t& msg);
     static void write_clock_config(msg_t& msg);
+
+/**
+ * \brief true if heartbeats should be sent: ALIVE_EN is set, events are
+ *  enabled, and replies are not muted.
+ */
+    static inline bool heartbeat_enabled()
+    {return self->regs_.r_operation_ctrl_bits.ALIVE_EN && events_enabled()
+            && !is_muted();}
+
+/**
+ * \brief if the next heartbeat is due, advance to the one after it.
+ * \param heartbeat_s set to the whole Harp second of the due heartbeat.
+ * \return true if a heartbeat was due.
+ * \note must not be interrupted by the heartbeat alarm.
+ */
+    static bool take_due_heartbeat(uint32_t& heartbeat_s);
+
+/**
+ * \brief send the `R_TIMESTAMP_SECOND` heartbeat EVENT timestamped at
+ *  exactly \p heartbeat_s and with \p heartbeat_s as its payload.
+ * \details unlike send_harp_reply(), R_TIMESTAMP_OFFSET and event latencies
+ *  are not subtracted, so the heartbeat always reads `N.000000`.
+ */
+    static void send_heartbeat(uint32_t heartbeat_s);
+
+/**
+ * \brief set the heartbeat alarm for the next heartbeat. If Harp time has
+ *  stepped away from it, start over from the next whole second.
+ * \note must not be interrupted by the heartbeat alarm.
+ */
+    static void arm_heartbeat();
+
+/**
+ * \brief schedule the next heartbeat for the next whole Harp second.
+ */
+    static void restart_heartbeat();
+
+/**
+ * \brief Callback fn for the alarm that issues heartbeats. Leaves the
+ *  `R_TIMESTAMP_SECOND` EVENT, timestamped at exactly the whole second, for
+ *  run() to send.
+ * \note Interrupt callbacks must be static, so this fn refers use the self ptr
+ *      to access the singleton data members.
+ */
+    static void heartbeat_alarm_callback(unsigned int alarm_num);
+
+/**
+ * \brief set alarms for Harp times again after Harp time changes (sync
+ *  corrections, or writes to the timestamp registers).
+ * \details safe to call from an interrupt.
+ */
+    static void clock_changed();
+
+/**
+ * \brief update GEN_ABLE and REP_ABLE in R_CLOCK_CONFIG to reflect the
+ *  attached synchronizer and clock generator.
+ */
+    static void update_clock_capabilities();
+
+/**
+ * \brief start or stop the clock generator to match CLK_GEN and CLK_REP in
+ *  R_CLOCK_CONFIG (and the sync lock when repeating), clearing the bits that
+ *  the device cannot honor.
+ */
+    static void update_clock_output();
+/**
+ * \brief Handle writing to the `R_TIMESTAMP_OFFSET` register: subtract
+ *  the written value (in `TIMESTAMP_OFFSET_STEP_US` increments) from all
+ *  outgoing timestamps.
+ */
     static void write_timestamp_offset(msg_t& msg);
 
+/**
+ * \brief Handle writing to the `R_TIME_PROBE` register: record when the
+ *  request was received and when its reply is sent in full-resolution Harp
+ *  time, so that the PC can measure the offset between its clock and ours
+ *  NTP-style. The written payload is ignored.
+ */
+    static void write_time_probe(msg_t& msg);
+
+/**
+ * \brief Handle writing to the `R_TIME_ADJUST` register: step Harp time by
+ *  the written (signed) number of microseconds.
+ */
+    static void write_time_adjust(msg_t& msg);
+
     Registers regs_; ///< struct of Harp core registers
 
 /**
  * \brief Function table containing the read/write handler functions, one pair
- *  per core register. Index is the register address.
+ *  per core register. Indexed by core_reg_index().
+ * \note Generated at compile time, so it lives in flash rather than RAM.
  */
-    RegFnPair reg_func_table_[CORE_REG_COUNT] =
+    inline static constexpr RegFnPair reg_func_table_[CORE_REG_COUNT]
+    HARP_CORE_TABLE_ATTR =
     {
         // { <read_fn_ptr>, <write_fn_prt>},
         {&HarpCore::read_reg_generic, &HarpCore::write_to_read_only_reg_error},
@@ -589,7 +1213,28 @@ private:
         {&HarpCore::read_reg_generic, &HarpCore::write_timestamp_offset},
         {&HarpCore::read_reg_generic, &HarpCore::write_to_read_only_reg_error},
         {&HarpCore::read_reg_generic, &HarpCore::write_to_read_only_reg_error},
+        {&HarpCore::read_reg_generic, &HarpCore::write_to_read_only_reg_error},
+        {&HarpCore::read_event_queue_stats, &HarpCore::write_to_read_only_reg_error},
+        {&HarpCore::read_reg_generic, &HarpCore::write_to_read_only_reg_error},
+        {&HarpCore::read_sync_quality, &HarpCore::write_to_read_only_reg_error},
+        {&HarpCore::read_sync_counters, &HarpCore::write_to_read_only_reg_error},
+        {&HarpCore::read_reg_generic, &HarpCore::write_time_probe},
+        {&HarpCore::read_reg_generic, &HarpCore::write_time_adjust},
+        {&HarpCore::read_reg_generic, &HarpCore::write_to_read_only_reg_error},
     };
+
+/**
+ * \brief true if every core register has a read and a write handler.
+ */
+    static constexpr bool reg_func_table_is_complete()
+    {
+        for (const RegFnPair& fns: reg_func_table_)
+        {
+            if (fns.read_fn_ptr == nullptr || fns.write_fn_ptr == nullptr)
+                return false;
+        }
+        return true;
+    }
 };
 
 #endif //HARP_CORE_H
@@ -0,0 +1,147 @@
+#ifndef HARP_EVENT_QUEUE_H
+#define HARP_EVENT_QUEUE_H
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <cstring> // for memcpy
+#include <reg_types.h>
+#include <harp_message.h>
+
+#ifndef HARP_EVENT_QUEUE_SIZE
+#define HARP_EVENT_QUEUE_SIZE (32) // Max number of pending events. Must be a
+                                   // power of 2.
+#endif
+
+#ifndef HARP_EVENT_MAX_PAYLOAD_SIZE
+#define HARP_EVENT_MAX_PAYLOAD_SIZE (8) // Largest event payload (in bytes)
+                                        // that can be queued.
+#endif
+
+/**
+ * \brief a pre-timestamped harp message (i.e: an EVENT) waiting to be handled.
+ */
+template <size_t PayloadSize>
+struct harp_event_t
+{
+    uint64_t harp_time_us;
+    msg_type_t type;
+    uint8_t address;
+    reg_type_t payload_type;
+    uint8_t num_bytes;
+    uint8_t payload[PayloadSize];
+};
+
+/**
+ * \brief Fixed-capacity, lock-free, single-producer/single-consumer ring of
+ *  harp messages.
+ * \details push() may be called from exactly one context at a time (i.e: one
+ *  interrupt handler, or several that cannot preempt each other). pop() may be
+ *  called from exactly one other context (i.e: the main loop or the other
+ *  core).
+ * \note Only atomic loads and stores are used, so this is lock-free on the
+ *  Cortex M0+, which lacks atomic read-modify-write instructions.
+ */
+template <size_t N, size_t PayloadSize = HARP_EVENT_MAX_PAYLOAD_SIZE>
+class EventQueue
+{
+    static_assert((N > 0) && ((N & (N - 1)) == 0),
+                  "EventQueue capacity must be a power of 2.");
+public:
+    using event_t = harp_event_t<PayloadSize>;
+
+    EventQueue()
+    :head_{0}, tail_{0}, dropped_{0}, high_water_{0}
+    {}
+
+/**
+ * \brief queue a message. Producer-side only.
+ * \return true if the message was queued. False if the queue was full or the
+ *  payload was too large, in which case the message is dropped and counted.
+ */
+    bool push(msg_type_t type, uint8_t address, const volatile uint8_t* data,
+              uint8_t num_bytes, reg_type_t payload_type,
+              uint64_t harp_time_us)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        if ((head - tail >= N) || (num_bytes > PayloadSize))
+        {
+            dropped_.store(dropped_.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_relaxed);
+            return false;
+        }
+        event_t& event = buffer_[head & (N - 1)];
+        event.harp_time_us = harp_time_us;
+        event.type = type;
+        event.address = address;
+        event.payload_type = payload_type;
+        event.num_bytes = num_bytes;
+        for (uint8_t i = 0; i < num_bytes; ++i)
+            event.payload[i] = data[i];
+        head_.store(head + 1, std::memory_order_release);
+        // Update high-water mark.
+        uint32_t count = head + 1 - tail;
+        if (count > high_water_.load(std::memory_order_relaxed))
+            high_water_.store(count, std::memory_order_relaxed);
+        return true;
+    }
+
+/**
+ * \brief remove the oldest message and copy it into \p event. Consumer-side
+ *  only.
+ * \return true if an event was removed. False if the queue was empty.
+ */
+    bool pop(event_t& event)
+    {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire))
+            return false;
+        memcpy(&event, &buffer_[tail & (N - 1)], sizeof(event));
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+/**
+ * \brief true if no events are pending.
+ */
+    bool empty() const
+    {return tail_.load(std::memory_order_relaxed)
+            == head_.load(std::memory_order_acquire);}
+
+/**
+ * \brief true if no more messages can be queued. Producer-side only.
+ */
+    bool full() const
+    {return (head_.load(std::memory_order_relaxed)
+             - tail_.load(std::memory_order_acquire)) >= N;}
+
+/**
+ * \brief total number of events successfully queued since startup.
+ */
+    uint32_t posted() const
+    {return head_.load(std::memory_order_relaxed);}
+
+/**
+ * \brief total number of events dropped since startup.
+ */
+    uint32_t dropped() const
+    {return dropped_.load(std::memory_order_relaxed);}
+
+/**
+ * \brief largest number of events that have been pending at once.
+ */
+    uint32_t high_water() const
+    {return high_water_.load(std::memory_order_relaxed);}
+
+    static constexpr size_t capacity()
+    {return N;}
+
+private:
+    event_t buffer_[N];
+    std::atomic<uint32_t> head_; ///< free-running write count. Producer-owned.
+    std::atomic<uint32_t> tail_; ///< free-running read count. Consumer-owned.
+    std::atomic<uint32_t> dropped_; ///< Producer-owned.
+    std::atomic<uint32_t> high_water_; ///< Producer-owned.
+};
+
+#endif // HARP_EVENT_QUEUE_H
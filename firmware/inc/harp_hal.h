@@ -0,0 +1,305 @@
+#ifndef HARP_HAL_H
+#define HARP_HAL_H
+#include <stdint.h>
+#include <stddef.h>
+
+// Hardware abstraction layer for everything harp core and the synchronizer
+// need from the platform: the microsecond clock and its alarms, the usb CDC
+// transport, the sync uarts and sync edge capture, and a few chip-specific
+// helpers.
+// RP2040 builds forward most calls to the Pico SDK inline, so the HAL adds no
+// overhead. Sync edge capture lives in harp_hal_rp2040.cpp. Host builds
+// (HARP_HOST_SIM) use the simulated backends in harp_hal_sim.cpp, which are
+// controlled through harp_hal_sim.h.
+
+#define HAL_UNIQUE_ID_SIZE (8) // Size (in bytes) of the board's unique id.
+
+#if defined(HARP_HOST_SIM)
+#include <harp_hal_sim.h>
+#else
+#include <tusb.h>
+#include <pico/stdlib.h>
+#include <pico/divider.h> // for fast hardware division with remainder.
+#include <pico/unique_id.h>
+#include <pico/bootrom.h>
+#include <pico/multicore.h>
+#include <hardware/timer.h>
+#include <hardware/uart.h>
+#include <hardware/irq.h>
+#include <hardware/sync.h>
+#endif
+
+// Sync edge capture. Latches the (lower 32 bits of the) microsecond timer on
+// the first falling edge of the sync uart's rx pin after being armed, without
+// waiting on interrupt latency.
+/**
+ * \brief set up edge capture on the specified pin.
+ * \return false if edge capture is unavailable (i.e: no free PIO state
+ *  machine or DMA channel).
+ */
+bool hal_sync_capture_init(uint8_t rx_pin);
+/**
+ * \brief discard any latched edge and latch the next falling edge. Call while
+ *  the line is idle.
+ */
+void hal_sync_capture_arm();
+/**
+ * \brief get the time of the edge latched since the last call to
+ *  hal_sync_capture_arm().
+ * \return false if no edge has been latched yet.
+ */
+bool hal_sync_capture_get(uint32_t* time_us_32);
+
+#if defined(HARP_HOST_SIM)
+// Clock.
+uint64_t hal_time_us_64();
+uint32_t hal_time_us_32();
+int hal_alarm_claim(void (*callback)(unsigned int alarm_num));
+bool hal_alarm_set_target(unsigned int alarm_num, uint64_t system_time_us);
+void hal_alarm_cancel(unsigned int alarm_num);
+
+// Division.
+uint32_t hal_divmod_u32u32_rem(uint32_t a, uint32_t b, uint32_t* rem);
+uint64_t hal_divmod_u64u64_rem(uint64_t a, uint64_t b, uint64_t* rem);
+uint64_t hal_div_u64u64(uint64_t a, uint64_t b);
+
+// Usb CDC transport.
+void hal_cdc_init();
+void hal_cdc_task();
+bool hal_cdc_connected();
+uint32_t hal_cdc_available();
+uint32_t hal_cdc_read(void* buffer, uint32_t num_bytes);
+uint32_t hal_cdc_write_available();
+uint32_t hal_cdc_write(const void* buffer, uint32_t num_bytes);
+void hal_cdc_write_flush();
+
+// Sync uart.
+void hal_sync_uart_init(uart_inst_t* uart, uint8_t rx_pin, uint32_t baudrate,
+                        uint8_t data_bits, uint8_t stop_bits,
+                        uart_parity_t parity, bool fifo_enabled,
+                        void (*rx_callback)(void));
+bool hal_sync_uart_is_readable(uart_inst_t* uart);
+uint8_t hal_sync_uart_getc(uart_inst_t* uart);
+void hal_sync_uart_tx_init(uart_inst_t* uart, uint8_t tx_pin,
+                           uint32_t baudrate, uint8_t data_bits,
+                           uint8_t stop_bits, uart_parity_t parity);
+void hal_sync_uart_write(uart_inst_t* uart, const uint8_t* data,
+                         size_t num_bytes);
+
+// Chip.
+void hal_get_unique_board_id(uint8_t id[HAL_UNIQUE_ID_SIZE]);
+void hal_reset_to_bootloader();
+void hal_launch_core1(void (*entry)(void));
+uint32_t hal_get_core_num();
+void hal_tight_loop_contents();
+uint32_t hal_save_and_disable_interrupts();
+void hal_restore_interrupts(uint32_t status);
+
+// Low-power waiting.
+void hal_wait_for_event_until(uint64_t system_time_us);
+void hal_send_event();
+
+#else
+// Clock.
+static inline uint64_t hal_time_us_64()
+{return time_us_64();}
+
+static inline uint32_t hal_time_us_32()
+{return time_us_32();}
+
+/**
+ * \brief claim an unused hardware alarm and attach a callback to it. The
+ *  callback runs in interrupt context.
+ * \return the alarm number or -1 if no alarm is free.
+ */
+static inline int hal_alarm_claim(void (*callback)(unsigned int alarm_num))
+{
+    int alarm_num = hardware_alarm_claim_unused(false);
+    if (alarm_num >= 0)
+        hardware_alarm_set_callback(uint(alarm_num), callback);
+    return alarm_num;
+}
+
+/**
+ * \brief call the alarm's callback once at the specified system time,
+ *  replacing any pending target.
+ * \return false (and never call the callback) if the time has already
+ *  passed.
+ */
+static inline bool hal_alarm_set_target(unsigned int alarm_num,
+                                        uint64_t system_time_us)
+{
+    return !hardware_alarm_set_target(alarm_num,
+                                      from_us_since_boot(system_time_us));
+}
+
+static inline void hal_alarm_cancel(unsigned int alarm_num)
+{hardware_alarm_cancel(alarm_num);}
+
+// Division.
+static inline uint32_t hal_divmod_u32u32_rem(uint32_t a, uint32_t b,
+                                             uint32_t* rem)
+{return divmod_u32u32_rem(a, b, rem);}
+
+static inline uint64_t hal_divmod_u64u64_rem(uint64_t a, uint64_t b,
+                                             uint64_t* rem)
+{return divmod_u64u64_rem(a, b, rem);}
+
+static inline uint64_t hal_div_u64u64(uint64_t a, uint64_t b)
+{return div_u64u64(a, b);}
+
+// Usb CDC transport.
+static inline void hal_cdc_init()
+{tusb_init();}
+
+static inline void hal_cdc_task()
+{tud_task();}
+
+static inline bool hal_cdc_connected()
+{return tud_cdc_connected();}
+
+static inline uint32_t hal_cdc_available()
+{return tud_cdc_available();}
+
+static inline uint32_t hal_cdc_read(void* buffer, uint32_t num_bytes)
+{return tud_cdc_read(buffer, num_bytes);}
+
+static inline uint32_t hal_cdc_write_available()
+{return tud_cdc_write_available();}
+
+static inline uint32_t hal_cdc_write(const void* buffer, uint32_t num_bytes)
+{return tud_cdc_write(buffer, num_bytes);}
+
+static inline void hal_cdc_write_flush()
+{tud_cdc_write_flush();}
+
+// Sync uart.
+/**
+ * \brief set up the sync uart and attach a callback to its rx interrupt.
+ * \param fifo_enabled if false, the callback is called for every byte.
+ *  Otherwise, it is called when the uart has gone idle for 32 bit periods
+ *  after receiving up to 16 bytes.
+ */
+static inline void hal_sync_uart_init(uart_inst_t* uart, uint8_t rx_pin,
+                                      uint32_t baudrate, uint8_t data_bits,
+                                      uint8_t stop_bits, uart_parity_t parity,
+                                      bool fifo_enabled,
+                                      void (*rx_callback)(void))
+{
+    uart_init(uart, baudrate);
+    // Disable hardware flow control.
+    uart_set_hw_flow(uart, false, false);
+    // Set data format
+    uart_set_format(uart, data_bits, stop_bits, parity);
+    // Setup the RX pin by using the function select on the GPIO
+    gpio_set_function(rx_pin, GPIO_FUNC_UART);
+    // Turn off internal FIFO (FIFO set to size 1) unless we read in bulk.
+    uart_set_fifo_enabled(uart, fifo_enabled);
+    // Select correct interrupt handler for the UART we are using.
+    int uart_irq = (uart == uart0) ? UART0_IRQ : UART1_IRQ;
+    // Attach the static callback function.
+    irq_set_exclusive_handler(uart_irq, rx_callback);
+    irq_set_enabled(uart_irq, true);
+    // Enable RX-based interrupts.
+    uart_set_irq_enables(uart, true, false);
+    // Only interrupt on a half-full FIFO or an rx timeout rather than on the
+    // default FIFO level of 4 bytes.
+    if (fifo_enabled)
+        hw_write_masked(&uart_get_hw(uart)->ifls,
+                        2 << UART_UARTIFLS_RXIFLSEL_LSB,
+                        UART_UARTIFLS_RXIFLSEL_BITS);
+}
+
+static inline bool hal_sync_uart_is_readable(uart_inst_t* uart)
+{return uart_is_readable(uart);}
+
+static inline uint8_t hal_sync_uart_getc(uart_inst_t* uart)
+{return uint8_t(uart_getc(uart));}
+
+/**
+ * \brief set up a uart to send sync packets.
+ */
+static inline void hal_sync_uart_tx_init(uart_inst_t* uart, uint8_t tx_pin,
+                                         uint32_t baudrate, uint8_t data_bits,
+                                         uint8_t stop_bits,
+                                         uart_parity_t parity)
+{
+    uart_init(uart, baudrate);
+    uart_set_hw_flow(uart, false, false);
+    uart_set_format(uart, data_bits, stop_bits, parity);
+    gpio_set_function(tx_pin, GPIO_FUNC_UART);
+    // Queue whole packets so that their bytes go out back-to-back.
+    uart_set_fifo_enabled(uart, true);
+}
+
+/**
+ * \brief queue bytes for sending. Transmission starts right away if the uart
+ *  is idle.
+ * \note only blocks if the uart's 32-byte tx FIFO is full.
+ */
+static inline void hal_sync_uart_write(uart_inst_t* uart, const uint8_t* data,
+                                       size_t num_bytes)
+{uart_write_blocking(uart, data, num_bytes);}
+
+// Chip.
+static inline void hal_get_unique_board_id(uint8_t id[HAL_UNIQUE_ID_SIZE])
+{
+    pico_unique_board_id_t unique_id;
+    pico_get_unique_board_id(&unique_id);
+    for (uint8_t i = 0; i < HAL_UNIQUE_ID_SIZE; ++i)
+        id[i] = unique_id.id[i];
+}
+
+static inline void hal_reset_to_bootloader()
+{reset_usb_boot(0, 0);}
+
+static inline void hal_launch_core1(void (*entry)(void))
+{multicore_launch_core1(entry);}
+
+static inline uint32_t hal_get_core_num()
+{return get_core_num();}
+
+static inline void hal_tight_loop_contents()
+{tight_loop_contents();}
+
+static inline uint32_t hal_save_and_disable_interrupts()
+{return save_and_disable_interrupts();}
+
+static inline void hal_restore_interrupts(uint32_t status)
+{restore_interrupts(status);}
+
+// Low-power waiting.
+static inline int64_t hal_wake_alarm_callback(alarm_id_t /*id*/,
+                                              void* /*user_data*/)
+{return 0;} // Returning from the interrupt is what wakes the core.
+
+/**
+ * \brief sleep (`__wfe()`) until an interrupt, an event sent with
+ *  hal_send_event() from either core, or the specified system time,
+ *  whichever comes first. Returns right away if an interrupt or event
+ *  happened since the last call.
+ * \details the timeout is an alarm in the SDK's default alarm pool, so it
+ *  does not take a hardware alarm of its own. Without the default alarm pool,
+ *  returns right away.
+ */
+static inline void hal_wait_for_event_until(uint64_t system_time_us)
+{
+#if !PICO_TIME_DEFAULT_ALARM_POOL_DISABLED
+    alarm_id_t alarm_id = add_alarm_at(from_us_since_boot(system_time_us),
+                                       hal_wake_alarm_callback, nullptr,
+                                       false);
+    if (alarm_id <= 0)
+        return; // The time has passed or the pool is full.
+    __wfe();
+    cancel_alarm(alarm_id);
+#endif
+}
+
+/**
+ * \brief wake both cores from hal_wait_for_event_until() (`__sev()`).
+ */
+static inline void hal_send_event()
+{__sev();}
+#endif
+
+#endif // HARP_HAL_H
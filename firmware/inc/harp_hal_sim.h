@@ -0,0 +1,192 @@
+#ifndef HARP_HAL_SIM_H
+#define HARP_HAL_SIM_H
+#include <stdint.h>
+#include <stddef.h>
+#include <tusb_config.h> // for usb CDC FIFO and packet sizes.
+
+// Simulated backends for host builds (HARP_HOST_SIM). The device side is
+// reached through the hal_* functions in harp_hal.h. The functions below play
+// the part of the outside world: the PC on the other end of the usb cable,
+// the sync signal source, and the passage of time.
+//
+// The simulated usb CDC port models tinyusb's behavior: the device writes into
+// a CFG_TUD_CDC_TX_BUFSIZE-byte tx FIFO that sends a packet to the PC as soon
+// as USBD_CDC_IN_OUT_MAX_SIZE bytes are queued, or a short packet on flush.
+// The PC writes into a CFG_TUD_CDC_RX_BUFSIZE-byte rx FIFO.
+// The simulated sync edge capture latches the clock when bytes are delivered
+// to a sync uart while it is armed.
+// Simulated alarm callbacks run inline, like the other simulated interrupts:
+// sim_clock_set_us() and sim_clock_advance_us() call every alarm that comes
+// due along the way, with the clock set to the alarm's target. With the
+// free-running clock, hal_cdc_task() (called from HarpCore::run()) calls the
+// alarms that are due.
+// hal_wait_for_event_until() models `__wfe()`: with the manual clock, it
+// moves the clock to the next alarm, the next timed write from the PC (see
+// sim_cdc_pc_write_at()), or the timeout, whichever comes first, unless an
+// interrupt or event is already pending. With the free-running clock, it
+// returns right away.
+// With the manual clock, the device's own work takes no time unless it is
+// given a cost with sim_cpu_set_costs().
+// The usb and uart functions are not thread-safe. Call them from the same
+// thread as HarpCore::run(). In dual-core mode, core1 runs on its own thread.
+
+// Sync uart stand-ins for the Pico SDK's uart types.
+typedef struct sim_uart_inst uart_inst_t;
+extern uart_inst_t* const sim_uart0;
+extern uart_inst_t* const sim_uart1;
+#define uart0 sim_uart0
+#define uart1 sim_uart1
+
+enum uart_parity_t
+{
+    UART_PARITY_NONE,
+    UART_PARITY_EVEN,
+    UART_PARITY_ODD
+};
+
+/**
+ * \brief a byte sent by a sync uart and the time its start edge went out.
+ */
+struct sim_uart_tx_byte_t
+{
+    uint64_t start_us;
+    uint8_t byte;
+};
+
+/**
+ * \brief time spent in hal_wait_for_event_until().
+ */
+struct sim_idle_stats_t
+{
+    uint32_t waits; ///< calls.
+    uint32_t sleeps; ///< calls that moved the clock.
+    uint64_t idle_us;
+};
+
+/**
+ * \brief simulated time that the device's own work takes with the manual
+ *  clock. Interrupts that come due meanwhile are delivered as the clock
+ *  passes them.
+ */
+struct sim_cpu_costs_t
+{
+    uint32_t run_ns; ///< per hal_cdc_task() call, i.e: per HarpCore::run().
+    uint32_t byte_ns; ///< per byte read with hal_cdc_read() or written with
+                      ///< hal_cdc_write().
+    uint32_t wake_us; ///< to resume after hal_wait_for_event_until() slept.
+};
+
+/**
+ * \brief usb traffic as seen by the simulated PC.
+ */
+struct sim_cdc_stats_t
+{
+    uint32_t full_packets;
+    uint32_t short_packets;
+    uint64_t bytes_to_pc;
+    uint64_t bytes_from_pc;
+};
+
+/**
+ * \brief reset every simulated backend to its power-on state: clock restarted
+ *  at zero and following the host's monotonic clock, usb connected with
+ *  empty FIFOs, and no pending alarms.
+ * \note sync uart callbacks and alarm claims stay attached since they belong
+ *  to singletons.
+ */
+void sim_reset();
+
+// Clock.
+/**
+ * \brief if true, time only moves with sim_clock_set_us() and
+ *  sim_clock_advance_us(). Otherwise, time follows the host's monotonic clock.
+ *  Defaults to false.
+ */
+void sim_clock_set_manual(bool manual);
+void sim_clock_set_us(uint64_t time_us);
+void sim_clock_advance_us(uint64_t delta_us);
+/**
+ * \brief charge the device's work to the manual clock. All costs are zero
+ *  by default and after sim_reset().
+ */
+void sim_cpu_set_costs(const sim_cpu_costs_t& costs);
+
+// Usb CDC transport. PC side.
+void sim_cdc_set_connected(bool connected);
+/**
+ * \brief send bytes from the PC to the device.
+ * \return number of bytes accepted. Less than \p num_bytes if the device's rx
+ *  FIFO is full.
+ */
+size_t sim_cdc_pc_write(const void* data, size_t num_bytes);
+/**
+ * \brief send bytes from the PC to the device once the clock reaches
+ *  \p time_us, like an interrupt: they are delivered as the clock passes
+ *  \p time_us and wake the device from hal_wait_for_event_until().
+ * \details bytes that do not fit in the device's rx FIFO are delivered as it
+ *  makes room.
+ */
+void sim_cdc_pc_write_at(uint64_t time_us, const void* data,
+                         size_t num_bytes);
+/**
+ * \brief receive bytes that the device has sent to the PC.
+ * \return number of bytes copied into \p data.
+ */
+size_t sim_cdc_pc_read(void* data, size_t max_bytes);
+/**
+ * \brief number of bytes sent to the PC that have not been read yet.
+ */
+size_t sim_cdc_pc_available();
+/**
+ * \brief discard every byte sent to the PC that has not been read yet.
+ */
+void sim_cdc_pc_discard();
+sim_cdc_stats_t sim_cdc_stats();
+
+// Sync uart. Signal source side.
+/**
+ * \brief deliver bytes to a sync uart at the current time, invoking its rx
+ *  interrupt callback like the RP2040 would: once per byte if the uart's FIFO
+ *  is disabled, or once after all the bytes otherwise.
+ */
+void sim_sync_uart_write(uart_inst_t* uart, const uint8_t* data,
+                         size_t num_bytes);
+/**
+ * \brief deliver bytes to a sync uart's rx FIFO at the current time without
+ *  invoking its rx interrupt callback. Latches the sync edge capture if it
+ *  is armed.
+ */
+void sim_sync_uart_receive(uart_inst_t* uart, const uint8_t* data,
+                           size_t num_bytes);
+/**
+ * \brief invoke a sync uart's rx interrupt callback, i.e: after some
+ *  interrupt latency. Like the RP2040's rx interrupts, it stays asserted
+ *  while the uart has unread bytes, so the callback runs again if it returns
+ *  before draining the uart.
+ */
+void sim_sync_uart_interrupt(uart_inst_t* uart);
+/**
+ * \brief a falling edge on the sync rx pin that delivers no byte (i.e: a byte
+ *  lost to a framing error). Latches the sync edge capture if it is armed.
+ */
+void sim_sync_line_edge();
+/**
+ * \brief make sync edge capture available (the default) or unavailable to
+ *  synchronizers initialized afterwards.
+ */
+void sim_sync_capture_set_available(bool available);
+/**
+ * \brief read (and remove) the bytes a sync uart has sent so far, in order.
+ * \return the number of bytes read.
+ */
+size_t sim_sync_uart_tx_read(uart_inst_t* uart, sim_uart_tx_byte_t* bytes,
+                             size_t max_bytes);
+
+// Chip.
+/**
+ * \brief true if the device asked to reboot into its bootloader.
+ */
+bool sim_reset_to_bootloader_requested();
+sim_idle_stats_t sim_idle_stats();
+
+#endif // HARP_HAL_SIM_H
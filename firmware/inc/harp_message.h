@@ -3,6 +3,9 @@
 #include <reg_types.h>
 
 #define MAX_PACKET_SIZE (255) // unused?
+#define HARP_TIMESTAMP_SIZE (6) // 4-byte seconds + 2-byte 32[us] ticks.
+// Largest outgoing timestamped frame: header + raw_length (up to 255) bytes.
+#define MAX_TIMESTAMPED_MSG_SIZE (2 + 255)
 
 enum msg_type_t: uint8_t
 {
@@ -35,11 +38,32 @@ struct msg_header_t
     uint8_t payload_base_index_offset()
     {return has_timestamp()? 11: 5;}
 
-    uint8_t checksum_index_offset()
-    {return 2 + raw_length;}
+    uint16_t checksum_index_offset()
+    {return 1 + raw_length;}
 
-    uint8_t msg_size()
+    uint16_t msg_size()
     {return raw_length + 2;}
+
+/**
+ * \brief true if the first \p num_bytes of the header could belong to a
+ *  message sent from the PC (a READ or WRITE with a valid payload type and
+ *  length).
+ */
+    bool is_plausible(uint16_t num_bytes)
+    {
+        if ((num_bytes >= 1) && (type != READ) && (type != WRITE))
+            return false;
+        if ((num_bytes >= 2) && (raw_length < 4))
+            return false;
+        if (num_bytes < sizeof(msg_header_t))
+            return true;
+        uint8_t type_size = payload_type
+                            & ~(IS_SIGNED | IS_FLOAT | HAS_TIMESTAMP);
+        if ((type_size != 1) && (type_size != 2) && (type_size != 4)
+            && (type_size != 8))
+            return false;
+        return has_timestamp()? raw_length >= 10: true;
+    }
 };
 #pragma pack(pop)
 
@@ -50,11 +74,17 @@ struct msg_t
     msg_header_t& header;
     void* payload;  // unknown type until we parse the header.
     uint8_t& checksum;
+    // Harp time (in [us]) at which the message's last byte was received, or 0
+    // if unknown. Pass it to send_harp_reply() or the scheduler to stamp
+    // replies and actions with the command's arrival time.
+    uint64_t rx_harp_time_us;
 
     // Custom reference-only constructor that refers to data in existing
     // memory locations.
-    msg_t(msg_header_t& header, void* payload, uint8_t& checksum)
-        :header{header}, payload{payload}, checksum{checksum}
+    msg_t(msg_header_t& header, void* payload, uint8_t& checksum,
+          uint64_t rx_harp_time_us = 0)
+        :header{header}, payload{payload}, checksum{checksum},
+         rx_harp_time_us{rx_harp_time_us}
     {}
 
     // (Inline) Member functions:
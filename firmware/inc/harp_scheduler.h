@@ -0,0 +1,241 @@
+#ifndef HARP_SCHEDULER_H
+#define HARP_SCHEDULER_H
+#include <stdint.h>
+#include <harp_hal.h>
+#include <harp_message.h>
+#include <harp_event_queue.h>
+
+#ifndef HARP_SCHEDULER_SIZE
+#define HARP_SCHEDULER_SIZE (16) // Max number of pending actions.
+#endif
+#ifndef HARP_SCHEDULER_MAX_PAYLOAD_SIZE
+#define HARP_SCHEDULER_MAX_PAYLOAD_SIZE (8) // Largest scheduled register write
+                                            // (in bytes).
+#endif
+#ifndef HARP_SCHEDULER_EVENT_QUEUE_SIZE
+#define HARP_SCHEDULER_EVENT_QUEUE_SIZE (16) // Max number of posted events
+                                             // waiting to be sent. Must be a
+                                             // power of 2.
+#endif
+#ifndef HARP_SCHEDULER_MAX_LATE_US
+#define HARP_SCHEDULER_MAX_LATE_US (20) // Count actions that run later than
+                                        // this after their Harp time.
+#endif
+
+// Scheduler that runs actions at specific Harp times: writing a register,
+//  posting an EVENT, or calling a function. Singleton.
+// Pending actions are kept in a min-heap ordered by Harp time (and then by
+//  the order they were scheduled in) and multiplexed onto one hardware alarm
+//  set for the earliest one, so actions run in interrupt context within
+//  interrupt latency of their deadline with no polling.
+// The alarm is set in system time. Whenever Harp time changes (sync
+//  corrections, or writes to the timestamp registers), remap() converts the
+//  earliest deadline again. HarpCore does this when the scheduler is attached
+//  with HarpCore::set_scheduler().
+// \note actions must be scheduled from the core that called init(), which
+//  also runs them.
+class HarpScheduler
+{
+private:
+    // Make constructor/destructor private.
+    HarpScheduler();
+    ~HarpScheduler();
+public:
+    // Disable copy constructor and assignment operator.
+    HarpScheduler(HarpScheduler& other) = delete;
+    void operator=(const HarpScheduler& other) = delete;
+
+/**
+ * \brief init the HarpScheduler singleton and return a reference to it.
+ */
+    static HarpScheduler& init();
+
+/**
+ * \brief return a pointer to the one-and-only instance or nullptr if
+ *      init() was never called.
+ */
+    static HarpScheduler& instance(){return *self;}
+
+/**
+ * \brief false if the scheduler could not claim a hardware alarm and cannot
+ *  run.
+ */
+    static inline bool is_available()
+    {return self->alarm_num_ >= 0;}
+
+/**
+ * \brief set the Harp time that deadlines are in, i.e: HarpCore's time.
+ * \details must be set before scheduling. Both conversions must be safe to
+ *  call from an interrupt.
+ */
+    static inline void set_time_source(
+        uint64_t (*system_to_harp_us_64)(uint64_t system_time_us),
+        uint64_t (*harp_to_system_us_64)(uint64_t harp_time_us))
+    {
+        self->system_to_harp_us_64_ = system_to_harp_us_64;
+        self->harp_to_system_us_64_ = harp_to_system_us_64;
+    }
+
+/**
+ * \brief call \p callback(\p context) at \p harp_time_us.
+ * \details the callback runs in interrupt context and may schedule further
+ *  actions (i.e: to run periodically).
+ * \return false if the scheduler is full or unavailable.
+ * \note actions whose time has already passed run as soon as possible.
+ */
+    static bool call_at(uint64_t harp_time_us, void (*callback)(void* context),
+                        void* context = nullptr);
+
+/**
+ * \brief copy \p num_bytes of \p data to \p dest (i.e: an app register) at
+ *  \p harp_time_us.
+ * \details \p data is copied when scheduled. No write handler runs and no
+ *  reply is sent. Schedule an event_at() for the same time to report the new
+ *  value, or a call_at() for side effects.
+ * \return false if the scheduler is full or unavailable, or if \p num_bytes
+ *  is larger than `HARP_SCHEDULER_MAX_PAYLOAD_SIZE`.
+ */
+    static bool write_at(uint64_t harp_time_us, volatile void* dest,
+                         const void* data, uint8_t num_bytes);
+
+/**
+ * \brief post an EVENT from register \p reg_name, timestamped
+ *  \p harp_time_us, at \p harp_time_us.
+ * \details the payload is the register's value when the event is posted.
+ *  Posted events wait in the scheduler's own queue (not the core's, so the
+ *  alarm interrupt may preempt or be preempted by the app's interrupts that
+ *  post events) until HarpCore::run() sends them. The scheduler must be
+ *  attached with HarpCore::set_scheduler().
+ * \return false if the scheduler is full or unavailable.
+ */
+    static bool event_at(uint64_t harp_time_us, uint8_t reg_name);
+
+    using event_t = EventQueue<HARP_SCHEDULER_EVENT_QUEUE_SIZE>::event_t;
+
+/**
+ * \brief remove the oldest event posted by an event_at() action and copy it
+ *  into \p event. Called by HarpCore::run() on core0.
+ * \return false if no events are waiting.
+ */
+    static inline bool pop_event(event_t& event)
+    {return (self != nullptr) && self->events_.pop(event);}
+
+/**
+ * \brief true if events posted by event_at() actions are waiting to be sent.
+ */
+    static inline bool has_events()
+    {return (self != nullptr) && !self->events_.empty();}
+
+/**
+ * \brief number of events that event_at() actions dropped because the
+ *  scheduler's event queue was full.
+ */
+    static inline uint32_t dropped_events()
+    {return self->events_.dropped();}
+
+/**
+ * \brief drop all pending actions.
+ */
+    static void cancel_all();
+
+/**
+ * \brief set the alarm for the earliest pending action again from its Harp
+ *  time. Call whenever Harp time changes.
+ * \details safe to call from an interrupt.
+ */
+    static void remap();
+
+/**
+ * \brief number of actions waiting to run.
+ */
+    static inline uint8_t pending()
+    {return self->count_;}
+
+/**
+ * \brief number of actions that ran more than `HARP_SCHEDULER_MAX_LATE_US`
+ *  after their Harp time since init().
+ */
+    static inline uint32_t late_actions()
+    {return self->late_actions_;}
+
+private:
+    enum action_type_t: uint8_t
+    {
+        CALL,
+        WRITE_REG,
+        POST_EVENT
+    };
+
+/**
+ * \brief an action waiting to run.
+ */
+    struct action_t
+    {
+        uint64_t harp_time_us;
+        uint32_t sequence; ///< breaks ties in scheduling order.
+        action_type_t type;
+        uint8_t reg_name; ///< for POST_EVENT.
+        uint8_t num_bytes; ///< for WRITE_REG.
+        uint8_t payload[HARP_SCHEDULER_MAX_PAYLOAD_SIZE]; ///< for WRITE_REG.
+        void (*callback)(void* context); ///< for CALL.
+        volatile void* target; ///< CALL context or WRITE_REG destination.
+    };
+
+/**
+ * \brief a pointer to the one-and-only instance or nullptr if init() was
+ *      never called.
+ */
+    static inline HarpScheduler* self = nullptr;
+
+/**
+ * \brief Callback fn for the alarm that fires on the earliest deadline.
+ * \note Interrupt callbacks must be static, so this fn refers use the self ptr
+ *      to access the singleton data members.
+ */
+    static void alarm_callback(unsigned int alarm_num);
+
+/**
+ * \brief add \p action to the heap and re-arm the alarm if it is now the
+ *  earliest.
+ */
+    static bool schedule(action_t& action);
+
+/**
+ * \brief run \p action. Called from the alarm interrupt.
+ */
+    static void run_action(const action_t& action);
+
+/**
+ * \brief set the alarm for the earliest pending action. Must be called with
+ *  interrupts disabled.
+ */
+    void arm();
+
+/**
+ * \brief true if \p a should run before \p b.
+ */
+    static inline bool precedes(const action_t& a, const action_t& b)
+    {
+        return (a.harp_time_us < b.harp_time_us)
+               || ((a.harp_time_us == b.harp_time_us)
+                   && (int32_t(a.sequence - b.sequence) < 0));
+    }
+
+    void sift_up(uint8_t index);
+    void sift_down(uint8_t index);
+
+    int alarm_num_; ///< -1 if no alarm was free.
+    uint64_t (*system_to_harp_us_64_)(uint64_t system_time_us);
+    uint64_t (*harp_to_system_us_64_)(uint64_t harp_time_us);
+
+    // members edited within an ISR must be volatile.
+
+    action_t actions_[HARP_SCHEDULER_SIZE]; ///< min-heap of pending actions.
+    volatile uint8_t count_;
+    uint32_t next_sequence_;
+    volatile uint32_t late_actions_;
+    EventQueue<HARP_SCHEDULER_EVENT_QUEUE_SIZE> events_; ///< posted by the
+                                                         ///< alarm only.
+};
+
+#endif // HARP_SCHEDULER_H
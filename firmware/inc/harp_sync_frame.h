@@ -0,0 +1,148 @@
+#ifndef HARP_SYNC_FRAME_H
+#define HARP_SYNC_FRAME_H
+#include <stdint.h>
+
+// The Harp clock sync packet: its format, its timing, and a decoder for it.
+// Free of hardware dependencies so that it can be tested on the host.
+// A sync packet is sent once per second (8N1, back-to-back bytes): two header
+//  bytes followed by the little-endian uint32_t number of elapsed seconds
+//  *before* the second that the packet announces.
+
+#define HARP_SYNC_BAUDRATE (100'000UL)
+#define HARP_SYNC_HEADER_0 (0xAA)
+#define HARP_SYNC_HEADER_1 (0xAF)
+#define HARP_SYNC_FRAME_SIZE (6) // bytes, including the header.
+#define HARP_SYNC_BITS_PER_BYTE (10) // start bit, 8 data bits, stop bit.
+#define HARP_SYNC_BYTE_DURATION_US \
+    (HARP_SYNC_BITS_PER_BYTE * 1'000'000UL / HARP_SYNC_BAUDRATE)
+#define HARP_SYNC_FRAME_DURATION_US \
+    (HARP_SYNC_FRAME_SIZE * HARP_SYNC_BYTE_DURATION_US) // time (in [us]) from
+                                                        // the packet's start
+                                                        // edge to the end of
+                                                        // its last byte.
+
+#define HARP_SYNC_LAST_BYTE_LEAD_US (672) // time (in [us]) from the start edge
+                                          // of the packet's last byte and the
+                                          // time specified in that packet.
+#define HARP_SYNC_OFFSET_US (672 - 90) // time (in [us]) from the per-byte rx
+                                       // interrupt of the last packet byte
+                                       // (~90[us] after that byte starts)
+                                       // and the time specified in that
+                                       // packet.
+#ifndef HARP_SYNC_EDGE_OFFSET_US
+#define HARP_SYNC_EDGE_OFFSET_US \
+    (HARP_SYNC_LAST_BYTE_LEAD_US \
+     + (HARP_SYNC_FRAME_SIZE - 1) * HARP_SYNC_BYTE_DURATION_US)
+                                       // time (in [us]) from the packet's
+                                       // start edge and the time specified
+                                       // in that packet.
+#endif
+
+/**
+ * \brief Harp time (in [us]) at the start edge of a sync packet.
+ * \param encoded_seconds the seconds encoded in the packet.
+ */
+constexpr uint64_t sync_frame_start_harp_us(uint32_t encoded_seconds)
+{
+    // Add 1[s] per protocol spec since the packet encodes the previous second.
+    return (uint64_t(encoded_seconds) + 1) * 1'000'000 - HARP_SYNC_EDGE_OFFSET_US;
+}
+
+/**
+ * \brief Harp time (in [us]) at the per-byte uart interrupt of a sync
+ *  packet's last byte.
+ * \param encoded_seconds the seconds encoded in the packet.
+ */
+constexpr uint64_t sync_frame_end_harp_us(uint32_t encoded_seconds)
+{return (uint64_t(encoded_seconds) + 1) * 1'000'000 - HARP_SYNC_OFFSET_US;}
+
+/**
+ * \brief extend a 32-bit timer value latched in the recent past to 64 bits.
+ * \param time_us_32 the latched (lower 32 bits of the) timer.
+ * \param later_time_us_64 a 64-bit timer reading taken after the latch, but
+ *  less than 2^32 [us] after it.
+ */
+constexpr uint64_t extend_time_us_32(uint32_t time_us_32,
+                                     uint64_t later_time_us_64)
+{return later_time_us_64 - uint32_t(uint32_t(later_time_us_64) - time_us_32);}
+
+/**
+ * \brief state machine that decodes sync packets one byte at a time.
+ */
+class SyncFrameDecoder
+{
+public:
+    enum State: uint8_t
+    {
+        RECEIVE_HEADER_0,
+        RECEIVE_HEADER_1,
+        RECEIVE_TIMESTAMP
+    };
+
+    SyncFrameDecoder()
+    :state_{RECEIVE_HEADER_0}, packet_index_{0}, sync_data_{0, 0, 0, 0}
+    {}
+
+/**
+ * \brief advance the state machine by one received byte.
+ * \return true if the byte completed a sync packet. Read it with
+ *  encoded_seconds().
+ */
+    bool push(uint8_t new_byte)
+    {
+        switch (state_)
+        {
+            case RECEIVE_HEADER_0:
+                if (new_byte == HARP_SYNC_HEADER_0)
+                    state_ = RECEIVE_HEADER_1;
+                break;
+            case RECEIVE_HEADER_1:
+                state_ = (new_byte == HARP_SYNC_HEADER_1)?
+                            RECEIVE_TIMESTAMP: RECEIVE_HEADER_0;
+                break;
+            case RECEIVE_TIMESTAMP:
+                sync_data_[packet_index_++] = new_byte;
+                if (packet_index_ < sizeof(sync_data_))
+                    break;
+                state_ = RECEIVE_HEADER_0;
+                packet_index_ = 0;
+                return true;
+        }
+        return false;
+    }
+
+/**
+ * \brief drop any partially received packet and wait for the next header.
+ */
+    void reset()
+    {
+        state_ = RECEIVE_HEADER_0;
+        packet_index_ = 0;
+    }
+
+/**
+ * \brief true if no packet is partially received.
+ */
+    bool idle() const
+    {return state_ == RECEIVE_HEADER_0;}
+
+    State state() const
+    {return state_;}
+
+/**
+ * \brief the seconds encoded in the last complete packet.
+ */
+    uint32_t encoded_seconds() const
+    {
+        return uint32_t(sync_data_[0]) | (uint32_t(sync_data_[1]) << 8)
+               | (uint32_t(sync_data_[2]) << 16)
+               | (uint32_t(sync_data_[3]) << 24);
+    }
+
+private:
+    State state_;
+    uint8_t packet_index_;
+    uint8_t sync_data_[4]; ///< little-endian seconds.
+};
+
+#endif // HARP_SYNC_FRAME_H
@@ -1,35 +1,96 @@
 #ifndef HARP_SYNCHRONIZER_H
 #define HARP_SYNCHRONIZER_H
 #include <stdint.h>
-#include <pico/stdlib.h>
-#include <hardware/uart.h>
-#include <hardware/irq.h>
-#include <hardware/sync.h>
-#include <hardware/structs/timer.h>
+#include <atomic>
+#include <harp_hal.h>
+#include <harp_sync_frame.h>
 
 #ifdef DEBUG
 #include <cstdio> // for printf
 #endif
 
-#define HARP_SYNC_BAUDRATE (100'000UL)
 #define HARP_SYNC_DATA_BITS (8)
 #define HARP_SYNC_STOP_BITS (1)
 #define HARP_SYNC_PARITY (UART_PARITY_NONE)
 
-#define HARP_SYNC_OFFSET_US (672 - 90) // time (in [us]) from the **end** of
-                                       // the last packet byte and the time
-                                       // specified in that packet.
+#define HARP_SYNC_MAX_EDGE_AGE_US (HARP_SYNC_FRAME_DURATION_US + 1'000)
+                                       // Max time from a latched start edge
+                                       // to decoding its packet.
+
+#define HARP_SYNC_STEP_THRESHOLD_US (1'000) // Step (rather than slew) Harp
+                                            // time if it disagrees with a
+                                            // sync packet by more than this.
+#define HARP_SYNC_MAX_RATE_PPM (500) // Max Harp clock rate correction.
+#ifndef HARP_SYNC_STATS_SHIFT
+#define HARP_SYNC_STATS_SHIFT (4) // Running residual statistics average over
+                                  // about 2^N sync packets.
+#endif
+#ifndef HARP_SYNC_FILTER_SIZE
+#define HARP_SYNC_FILTER_SIZE (5) // Number of recent residuals that outliers
+                                  // are compared against. Must be odd.
+#endif
+#ifndef HARP_SYNC_OUTLIER_BOUND_US
+#define HARP_SYNC_OUTLIER_BOUND_US (50) // Default max deviation of a residual
+                                        // from the recent median.
+#endif
+#ifndef HARP_SYNC_TIMEOUT_US
+#define HARP_SYNC_TIMEOUT_US (2'500'000) // Default time without sync packets
+                                         // after which we enter holdover.
+#endif
+#ifndef HARP_SYNC_SERVO_KP_SHIFT
+#define HARP_SYNC_SERVO_KP_SHIFT (1) // Proportional gain of 1/2^N: the
+                                     // fraction of the phase error slewed
+                                     // out per sync period.
+#endif
+#ifndef HARP_SYNC_SERVO_KI_SHIFT
+#define HARP_SYNC_SERVO_KI_SHIFT (3) // Integral gain of 1/2^N: the fraction of
+                                     // the phase error folded into the drift
+                                     // estimate per sync period.
+#endif
 
 // Synchronizer that updates RP2040's timekeeping registers according to
 //  specific uart input. Singleton.
+// Harp time is a linear function of system time (a reference point plus a
+//  rate correction). Each sync packet feeds a PI servo that estimates the
+//  crystal drift and slews out any phase error, so Harp time does not jump
+//  by the accumulated drift every second.
+// If sync packets stop arriving, the synchronizer enters holdover: Harp time
+//  free-runs at the last drift estimate until packets resume.
+// Where the hardware allows it, each packet is timestamped by latching the
+//  timer on the packet's start edge (see hal_sync_capture_init()), and its
+//  bytes are read in bulk with one interrupt. Otherwise, the packet is
+//  timestamped in the uart interrupt of its last byte.
 class HarpSynchronizer
 {
 public:
-    enum SyncState
+/**
+ * \brief Harp time as a function of system time: at #system_us, Harp time
+ *  is #harp_us, and Harp time advances (1 + #rate_q32 / 2^32) [us] per
+ *  system [us].
+ */
+    struct ClockModel
+    {
+        uint64_t system_us;
+        uint64_t harp_us;
+        int32_t rate_q32;
+    };
+
+/**
+ * \brief sync quality statistics. A residual is the difference between a
+ *  sync packet's time and the local Harp time when it arrived, before the
+ *  servo corrects it.
+ */
+    struct SyncStats
     {
-        RECEIVE_HEADER_0,
-        RECEIVE_HEADER_1,
-        RECEIVE_TIMESTAMP
+        int32_t last_residual_ns; ///< residual of the last packet.
+        int32_t mean_residual_ns; ///< running mean of the residuals.
+        int32_t jitter_ns; ///< running mean absolute deviation of residuals.
+        int32_t drift_ppb; ///< estimated crystal drift. Positive if slow.
+        uint32_t packets_received; ///< complete sync packets received.
+        uint32_t packets_rejected; ///< packets not used to steer the clock.
+        uint32_t lock_losses; ///< times the lock was lost (holdover entered).
+        uint64_t sync_age_us; ///< time since the last valid packet, or
+                              ///< UINT64_MAX if never synced.
     };
 
 private:
@@ -54,54 +115,87 @@ public:
     static HarpSynchronizer& instance(){return *self;}
 
 /**
- * \brief convert system time (in 64-bit microseconds) to local system time
- *  (in 64-bit microseconds)
+ * \brief convert system time (in 64-bit microseconds) to Harp time
+ *  (in 64-bit microseconds), applying the estimated rate correction.
  * \details this utility function is useful for timestamping events in the
  *  local time domain and then calculating when they happened in Harp time.
- * \note if the device is unsynchronized (i.e: offset = 0), the returned time
- *  will be in local system time.
+ * \note if the device is unsynchronized, the returned time will be in local
+ *  system time.
  */
     static inline uint64_t system_to_harp_us_64(uint64_t system_time_us)
-    {return system_time_us - self->offset_us_64_;}
+    {return system_to_harp_us_64(system_time_us, self->clock_model());}
+
+/**
+ * \brief convert system time to Harp time with the specified clock model.
+ */
+    static inline uint64_t system_to_harp_us_64(uint64_t system_time_us,
+                                                const ClockModel& model)
+    {
+        int64_t elapsed_us = int64_t(system_time_us - model.system_us);
+        return model.harp_us + elapsed_us
+               + ((elapsed_us * model.rate_q32) >> 32);
+    }
 
 /**
  * \brief Override the current Harp time with a specific time.
+ * \details Harp time steps to the new value. The drift estimate is kept.
  * \note useful if a separate entity besides the synchronizer input jack
  *  needs to set the time (i.e: specifying the time over Harp protocol by
  *  writing to timestamp registers).
  */
-    static inline void set_harp_time_us_64(uint64_t harp_time_us)
-    {self->offset_us_64_ = ::time_us_64() - harp_time_us;}
+    static void set_harp_time_us_64(uint64_t harp_time_us);
 
 /**
  * \brief get the total elapsed microseconds (64-bit) in "Harp" time.
- * \warning this value is not monotonic and can change at any time if an
- *  external synchronizer is physically connected and operating.
- * \note if the device is unsynchronized (i.e: offset = 0), the returned time
- *  will be in local system time.
+ * \warning Harp time is slewed to follow the external synchronizer, but it
+ *  steps if the external time and the local time disagree by more than
+ *  `HARP_SYNC_STEP_THRESHOLD_US` (i.e: upon the first sync packet).
+ * \note if the device is unsynchronized, the returned time will be in local
+ *  system time.
  */
     static inline uint64_t time_us_64()
-    {return system_to_harp_us_64(::time_us_64());}
+    {return system_to_harp_us_64(hal_time_us_64());}
 
 /**
  * \brief get the total elapsed microseconds (32-bit) in "Harp" time.
- * \warning this value is not monotonic and can change at any time if an
- *  external synchronizer is physically connected and operating.
+ * \details equal to truncating time_us_64(), but cheaper: within about 2[s]
+ *  of the last clock model update (i.e: always while synced), the rate
+ *  correction takes one 32x32-bit multiply instead of a 64-bit one, which
+ *  the Cortex-M0+ does in software.
+ * \warning see time_us_64().
  */
     static inline uint32_t time_us_32()
-    {return uint32_t(time_us_64());}    // FIXME: this should execute faster
-                                        // but truncating for speed involves
-                                        // checking a bunch of edge cases.
+    {
+        // Truncation distributes over the sum in system_to_harp_us_64(), so
+        // only its rate correction needs the full elapsed time.
+        ClockModel model = self->clock_model();
+        uint64_t elapsed_us = hal_time_us_64() - model.system_us;
+        uint32_t harp_us = uint32_t(model.harp_us) + uint32_t(elapsed_us);
+        if (elapsed_us < (uint64_t(1) << FAST_ELAPSED_BITS))
+            return harp_us + uint32_t(fast_rate_correction_us(
+                                          uint32_t(elapsed_us),
+                                          model.rate_q32));
+        return harp_us + uint32_t((int64_t(elapsed_us) * model.rate_q32)
+                                  >> 32);
+    }
 
 /**
  * \brief convert harp time (in 64-bit microseconds) to local system time
- *  (in 64-bit microseconds).
+ *  (in 64-bit microseconds), applying the estimated rate correction.
  * \details this utility function is useful for setting alarms in the device's
  *  local time domain, which is monotonic and unchanged by adjustments to
  *  the harp time.
+ * \note the rate correction is applied to first order, which is accurate to
+ *  well under 1[us] for rate corrections up to `HARP_SYNC_MAX_RATE_PPM` and
+ *  times up to several hours away from the last sync packet.
  */
     static inline uint64_t harp_to_system_us_64(uint64_t harp_time_us)
-    {return harp_time_us + self->offset_us_64_;}
+    {
+        ClockModel model = self->clock_model();
+        int64_t elapsed_us = int64_t(harp_time_us - model.harp_us);
+        return model.system_us + elapsed_us
+               - ((elapsed_us * model.rate_q32) >> 32);
+    }
 
 /**
  * \brief convert harp time (in 32-bit microseconds) to local system time
@@ -114,11 +208,112 @@ public:
     {return uint32_t(harp_to_system_us_64(harp_time_us));}
 
 /**
- * \brief true if the synchronizer has received at least one external sync
- *  signal.
+ * \brief true if the synchronizer is locked to the external clock, i.e: it
+ *  has received a sync packet within the sync timeout.
+ * \note the lock is only released by update().
  */
     static inline bool is_synced()
-    {return self->has_synced_;}
+    {return self->locked_;}
+
+/**
+ * \brief true if the synchronizer has lost the external clock after
+ *  synchronizing at least once. Harp time is extrapolated with the last
+ *  drift estimate.
+ */
+    static inline bool in_holdover()
+    {return self->has_synced_ && !self->locked_;}
+
+/**
+ * \brief set how long to wait for a sync packet before entering holdover.
+ *  Defaults to `HARP_SYNC_TIMEOUT_US`.
+ * \note sync packets arrive once per second, so values under 1[s] will
+ *  release the lock between packets.
+ */
+    static inline void set_sync_timeout_us(uint32_t timeout_us)
+    {self->sync_timeout_us_ = timeout_us;}
+
+/**
+ * \brief set how far a sync packet's residual may deviate from the median
+ *  of the last `HARP_SYNC_FILTER_SIZE` residuals before it is rejected.
+ *  Defaults to `HARP_SYNC_OUTLIER_BOUND_US`. 0 disables outlier rejection.
+ * \details packets delayed by interrupt latency (i.e: usb or app interrupts
+ *  preempting the sync uart interrupt) are rejected rather than steering
+ *  Harp time. At most `HARP_SYNC_FILTER_SIZE` / 2 packets in a row are
+ *  rejected so that real changes are still tracked. Rejected packets do not
+ *  steer Harp time, but they do refresh the sync lock.
+ */
+    static inline void set_outlier_bound_us(uint32_t bound_us)
+    {self->outlier_bound_us_ = bound_us;}
+
+/**
+ * \brief call \p callback whenever the mapping between system time and Harp
+ *  time changes (i.e: to set alarms for Harp times again). nullptr disables
+ *  it.
+ * \details the callback usually runs from the sync uart interrupt (and
+ *  otherwise with interrupts disabled), so it must be short and
+ *  interrupt-safe.
+ */
+    static inline void set_clock_change_callback(void (*callback)())
+    {self->clock_change_callback_ = callback;}
+
+/**
+ * \brief a consistent snapshot of the sync quality statistics.
+ * \details Must run on the core that handles the sync uart interrupt.
+ * \note running statistics only include packets that slewed the clock.
+ *  Packets that stepped it only update #SyncStats::last_residual_ns.
+ */
+    static SyncStats stats();
+
+/**
+ * \brief release the lock and enter holdover if no sync packet has arrived
+ *  within the sync timeout.
+ * \details Call periodically from the main loop (HarpCore does this in
+ *  HarpCore::run()). Must run on the core that handles the sync uart
+ *  interrupt.
+ */
+    static void update();
+
+/**
+ * \brief the estimated drift of the local crystal relative to the external
+ *  clock in parts-per-2^32. Positive if the local clock runs slow.
+ */
+    static inline int32_t drift_q32()
+    {return self->drift_q32_;}
+
+/**
+ * \brief a consistent copy of the current clock model.
+ * \details safe to call from any context, including interrupts that preempt
+ *  the sync uart interrupt and the other core.
+ */
+    ClockModel clock_model() const
+    {
+        while (true)
+        {
+            uint32_t version = model_version_.load(std::memory_order_acquire);
+            ClockModel model = models_[version & 1];
+            // As soon as the writer publishes the next version, the slot this
+            // copy came from becomes the inactive one, and the writer may
+            // start rewriting it. So the copy is only valid if the version is
+            // unchanged.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (model_version_.load(std::memory_order_relaxed) == version)
+                return model;
+        }
+    }
+
+/**
+ * \brief steer Harp time to agree with an external time reference.
+ * \details Called with every sync packet. The first call steps Harp time.
+ *  Afterwards, if the local and external time disagree by more than
+ *  `HARP_SYNC_STEP_THRESHOLD_US`, Harp time only steps once two calls in a
+ *  row agree on the step (so that one corrupted packet cannot throw Harp
+ *  time off by seconds). Otherwise, a PI servo
+ *  updates the drift estimate and sets the clock rate to slew out the phase
+ *  error over the next sync period, keeping Harp time continuous.
+ * \param system_time_us system time at which the reference was valid.
+ * \param harp_time_us external Harp time at \p system_time_us.
+ */
+    void discipline_clock(uint64_t system_time_us, uint64_t harp_time_us);
 
 private:
 /**
@@ -128,31 +323,152 @@ private:
     static inline HarpSynchronizer* self = nullptr;
 
 /**
- * \brief Callback fn for uart interrupt triggered when a new byte arrives.
+ * \brief elapsed times below 2^N [us] (about 2[s]) take the fast path in
+ *  time_us_32(). The rest of the 32 bits hold the rate's high part.
+ */
+    static constexpr uint32_t FAST_ELAPSED_BITS = 21;
+    static constexpr uint32_t RATE_LOW_BITS = 32 - FAST_ELAPSED_BITS;
+    static_assert(((int64_t(HARP_SYNC_MAX_RATE_PPM) << 32) / 1'000'000)
+                  < (int64_t(1) << (2 * RATE_LOW_BITS)),
+                  "HARP_SYNC_MAX_RATE_PPM is too large for the fast path of "
+                  "time_us_32().");
+
+/**
+ * \brief `(elapsed_us * rate_q32) >> 32` (rounded down like the 64-bit
+ *  shift) with two 32x32-bit multiplies, which the Cortex-M0+ does in
+ *  hardware.
+ * \details splits the rate into a high part (in units of 2^`RATE_LOW_BITS`)
+ *  and a low part. The high product is split at 2^`FAST_ELAPSED_BITS` into
+ *  whole microseconds and a remainder, and the remainder's sum with the low
+ *  product carries at most one more microsecond.
+ * \param elapsed_us less than 2^`FAST_ELAPSED_BITS`.
+ */
+    static inline int32_t fast_rate_correction_us(uint32_t elapsed_us,
+                                                  int32_t rate_q32)
+    {
+        const uint32_t low_mask = (uint32_t(1) << RATE_LOW_BITS) - 1;
+        const uint32_t fraction_mask = (uint32_t(1) << FAST_ELAPSED_BITS) - 1;
+        uint32_t rate_low = uint32_t(rate_q32) & low_mask;
+        int32_t rate_high = (rate_q32 - int32_t(rate_low))
+                            / (int32_t(1) << RATE_LOW_BITS);
+        // |rate_high| < 2^RATE_LOW_BITS, so the products fit in 32 bits.
+        uint32_t high_product =
+            elapsed_us * uint32_t((rate_high < 0)? -rate_high: rate_high);
+        int32_t correction_us;
+        uint32_t fraction;
+        if (rate_high >= 0)
+        {
+            correction_us = int32_t(high_product >> FAST_ELAPSED_BITS);
+            fraction = high_product & fraction_mask;
+        }
+        else
+        {
+            correction_us = -int32_t(high_product >> FAST_ELAPSED_BITS)
+                            - (((high_product & fraction_mask) != 0)? 1: 0);
+            fraction = (0u - high_product) & fraction_mask;
+        }
+        uint32_t low_product = elapsed_us * rate_low;
+        uint32_t sum = (fraction << RATE_LOW_BITS) + low_product;
+        return correction_us + ((sum < low_product)? 1: 0);
+    }
+
+/**
+ * \brief Callback fn for uart interrupt triggered when new bytes arrive.
  * \note Interrupt callbacks must be static, so this fn refers use the self ptr
  *      to access the singleton data members.
  */
     static void uart_rx_callback();
 
     uart_inst_t* uart_id_;
+    SyncFrameDecoder decoder_; ///< only used within the uart ISR.
+    bool edge_capture_; ///< true if packets are timestamped by edge capture.
 
     // members edited within an ISR must be volatile.
-    volatile SyncState state_;
-    volatile uint8_t packet_index_;
-    volatile bool new_timestamp_;
 
-    volatile uint64_t offset_us_64_;
+    volatile bool has_synced_; ///< true after the first sync packet.
+    volatile bool locked_; ///< true while sync packets arrive in time.
+    uint32_t sync_timeout_us_;
+
+    // Sync quality statistics. See SyncStats.
+    int32_t last_residual_ns_;
+    int32_t mean_residual_ns_;
+    int32_t jitter_ns_;
+    uint32_t packets_received_;
+    uint32_t packets_rejected_;
+    uint32_t lock_losses_;
+
+    // Outlier rejection.
+    int32_t residuals_us_[HARP_SYNC_FILTER_SIZE]; ///< ring of recent accepted
+                                                  ///< residuals.
+    uint8_t residual_index_; ///< next slot to write in #residuals_us_.
+    uint8_t residual_count_; ///< valid residuals in #residuals_us_.
+    uint8_t consecutive_rejections_;
+    uint32_t outlier_bound_us_;
+    bool step_pending_; ///< true if the last packet asked for a step.
+    int64_t pending_step_us_; ///< the phase error of that packet.
 
-    volatile bool has_synced_;
 /**
- * \brief container to store the little-endian timestamp and then
- *  reinterpret-cast to the value.
+ * \brief check a residual against the median of the recent accepted
+ *  residuals, and add it to them unless it is rejected.
+ * \return true if the packet should be rejected.
  */
-    alignas(uint32_t) volatile uint8_t sync_data_[4];
+    bool is_outlier(int32_t residual_us);
 
+/**
+ * \brief double-buffered clock model. The writer updates the inactive slot
+ *  and then bumps #model_version_. Readers retry if #model_version_ changed
+ *  while they copied the active slot.
+ */
+    ClockModel models_[2];
+    std::atomic<uint32_t> model_version_; ///< active slot is version & 1.
+
+/**
+ * \brief estimated drift (integral term of the servo).
+ */
+    volatile int32_t drift_q32_;
+
+/**
+ * \brief system time of the last sync packet applied with
+ *  discipline_clock().
+ */
+    uint64_t last_sync_system_us_;
+
+/**
+ * \brief system time of the last sync packet received, even if it was
+ *  rejected or (with edge capture) damaged. The lock is held while packets
+ *  keep arriving.
+ */
+    uint64_t last_packet_system_us_;
+
+/**
+ * \brief true while free-running at the drift estimate because no packet
+ *  was applied within the sync timeout.
+ */
+    bool coasting_;
+
+/**
+ * \brief called after every clock model change, or nullptr.
+ */
+    void (*clock_change_callback_)();
+
+/**
+ * \brief publish a new clock model. Must not be called concurrently from
+ *  two contexts.
+ */
+    void set_clock_model(const ClockModel& model)
+    {
+        uint32_t version = model_version_.load(std::memory_order_relaxed);
+        // Readers of the retiring slot must see the version change before
+        // they can see it rewritten.
+        std::atomic_thread_fence(std::memory_order_release);
+        models_[(version + 1) & 1] = model;
+        model_version_.store(version + 1, std::memory_order_release);
+        if (clock_change_callback_ != nullptr)
+            clock_change_callback_();
+    }
 /**
  * \brief HarpCore is a friend such that updating the HarpCore's timestamp
- *  registers will update the HarpSynchronizer #offset_us_64_ instead of
+ *  registers will update the HarpSynchronizer's clock model instead of
  *  the HarpCore's internal offset.
  */
     friend class HarpCore;
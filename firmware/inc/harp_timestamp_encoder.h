@@ -0,0 +1,94 @@
+#ifndef HARP_TIMESTAMP_ENCODER_H
+#define HARP_TIMESTAMP_ENCODER_H
+#include <stdint.h>
+#include <harp_hal.h>
+#include <harp_message.h>
+
+/**
+ * \brief encodes Harp times (in [us]) into the 6-byte timestamp of a Harp
+ *  message: the little-endian uint32_t elapsed seconds followed by the
+ *  little-endian uint16_t elapsed 32[us] ticks within that second.
+ * \details splitting a 64-bit time into seconds takes a 64-bit division,
+ *  which the RP2040 does not have in hardware. Instead, the encoder caches
+ *  the last second that it encoded and only divides when a time is not
+ *  within a second of it. Messages are sent in roughly increasing time
+ *  order, so this happens once after boot and after Harp time steps.
+ * \note not thread-safe. Use one encoder per context that encodes.
+ */
+class TimestampEncoder
+{
+public:
+    TimestampEncoder()
+    :second_start_us_{0}, seconds_{0}
+    {}
+
+/**
+ * \brief split \p harp_time_us into elapsed seconds and 32[us] ticks.
+ */
+    inline void encode(uint64_t harp_time_us, uint32_t& seconds,
+                       uint16_t& ticks)
+    {
+        int64_t us_into_second = int64_t(harp_time_us - second_start_us_);
+        if (us_into_second >= 1'000'000LL)
+        {
+            if (us_into_second < 2'000'000LL) // next second.
+            {
+                us_into_second -= 1'000'000;
+                second_start_us_ += 1'000'000;
+                ++seconds_;
+            }
+            else
+                us_into_second = resync(harp_time_us);
+        }
+        else if (us_into_second < 0)
+        {
+            // Events can be timestamped before the last message was sent.
+            if ((us_into_second >= -1'000'000LL) && (seconds_ > 0))
+            {
+                us_into_second += 1'000'000;
+                second_start_us_ -= 1'000'000;
+                --seconds_;
+            }
+            else
+                us_into_second = resync(harp_time_us);
+        }
+        seconds = seconds_;
+        ticks = uint16_t(uint32_t(us_into_second) >> 5);
+    }
+
+/**
+ * \brief write the message timestamp for \p harp_time_us to
+ *  \p timestamp (`HARP_TIMESTAMP_SIZE` bytes).
+ */
+    inline void encode(uint64_t harp_time_us, uint8_t* timestamp)
+    {
+        uint32_t seconds;
+        uint16_t ticks;
+        encode(harp_time_us, seconds, ticks);
+        timestamp[0] = uint8_t(seconds);
+        timestamp[1] = uint8_t(seconds >> 8);
+        timestamp[2] = uint8_t(seconds >> 16);
+        timestamp[3] = uint8_t(seconds >> 24);
+        timestamp[4] = uint8_t(ticks);
+        timestamp[5] = uint8_t(ticks >> 8);
+    }
+
+private:
+/**
+ * \brief re-divide to cache the second containing \p harp_time_us.
+ * \return the microseconds elapsed within that second.
+ */
+    inline int64_t resync(uint64_t harp_time_us)
+    {
+        uint64_t us_into_second;
+        seconds_ = uint32_t(hal_divmod_u64u64_rem(harp_time_us, 1'000'000ULL,
+                                                  &us_into_second));
+        second_start_us_ = harp_time_us - us_into_second;
+        return int64_t(us_into_second);
+    }
+
+    uint64_t second_start_us_; ///< Harp time at the start of #seconds_.
+    uint32_t seconds_; ///< the last second encoded.
+};
+
+#endif // HARP_TIMESTAMP_ENCODER_H
@@ -35,6 +35,10 @@
 #define CFG_TUD_CDC_RX_BUFSIZE  (256)
 #define CFG_TUD_CDC_TX_BUFSIZE  (256)
 
+// CDC bulk endpoint packet size. Shared with the harp core so it can pack
+// outgoing messages into full usb packets.
+#define USBD_CDC_IN_OUT_MAX_SIZE (64)
+
 // We use a vendor specific interface but with our own driver
 #define CFG_TUD_VENDOR            (0)
 
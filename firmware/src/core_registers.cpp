@@ -17,7 +17,16 @@ Registers::Registers(uint16_t who_am_i,
        .R_FW_VERSION_L = fw_version_minor,
        .R_OPERATION_CTRL = 0,
        .R_SERIAL_NUMBER = serial_number,
-       .R_UUID = {0} // all zeros.
+       .R_CLOCK_CONFIG = (1u << CLK_UNLOCK_OFFSET), // Not synced yet.
+       .R_UUID = {0}, // all zeros.
+       .R_TX_STATS = {0, 0, 0, 0, 0},
+       .R_EVENT_QUEUE_STATS = {0, 0, 0, 0},
+       .R_RX_ERRORS = {0, 0, 0, 0, 0},
+       .R_SYNC_QUALITY = {0, 0, 0, 0},
+       .R_SYNC_COUNTERS = {0, 0, UINT32_MAX, 0},
+       .R_TIME_PROBE = {0, 0},
+       .R_TIME_ADJUST = 0,
+       .R_RX_LATENCY = {0, 0, 0, 0}
         }
 {
     strcpy((char*)regs_.R_DEVICE_NAME, name);
@@ -51,10 +51,18 @@ HarpCApp::~HarpCApp(){self = nullptr;}
 void HarpCApp::handle_buffered_app_message()
 {
     msg_t msg = get_buffered_msg();
+    // Ignore out-of-range msgs.
+    if (!handle_app_message(msg))
+        return;
+    clear_msg();
+}
+
+bool HarpCApp::handle_app_message(msg_t& msg)
+{
     // Ignore out-of-range msgs.
     if (msg.header.address < APP_REG_START_ADDRESS ||
         msg.header.address >= (APP_REG_START_ADDRESS + reg_count_))
-        return;
+        return false;
     uint8_t app_reg_address = msg.header.address - APP_REG_START_ADDRESS;
     switch (msg.header.type)
     {
@@ -71,7 +79,7 @@ void HarpCApp::handle_buffered_app_message()
             break;
         }
     }
-    clear_msg();
+    return true;
 }
 
 void HarpCApp::dump_app_registers()
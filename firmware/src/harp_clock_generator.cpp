@@ -0,0 +1,108 @@
+#include <harp_clock_generator.h>
+
+HarpClockGenerator::HarpClockGenerator(uart_inst_t* uart_id,
+                                       uint8_t uart_tx_pin)
+:uart_id_{uart_id}, alarm_num_{-1}, system_to_harp_us_64_{nullptr},
+ harp_to_system_us_64_{nullptr}, running_{false}, encoded_seconds_{0},
+ packets_sent_{0}, packets_skipped_{0}
+{
+    // Create a pointer to the first (and one-and-only) instance created.
+    if (self == nullptr)
+        self = this;
+    hal_sync_uart_tx_init(uart_id_, uart_tx_pin, HARP_SYNC_BAUDRATE,
+                          HARP_SYNC_DATA_BITS, HARP_SYNC_STOP_BITS,
+                          HARP_SYNC_PARITY);
+    alarm_num_ = hal_alarm_claim(alarm_callback);
+}
+
+HarpClockGenerator::~HarpClockGenerator(){self = nullptr;}
+
+HarpClockGenerator& HarpClockGenerator::init(uart_inst_t* uart_id,
+                                             uint8_t uart_tx_pin)
+{
+    static HarpClockGenerator generator(uart_id, uart_tx_pin);
+    return generator;
+}
+
+void HarpClockGenerator::start()
+{
+    if (self->running_ || !is_available()
+        || (self->system_to_harp_us_64_ == nullptr))
+        return;
+    self->running_ = true;
+    self->schedule_next_packet();
+}
+
+void HarpClockGenerator::stop()
+{
+    if (!self->running_)
+        return;
+    self->running_ = false;
+    hal_alarm_cancel((unsigned int)self->alarm_num_);
+}
+
+void HarpClockGenerator::remap()
+{
+    if ((self == nullptr) || !self->running_)
+        return;
+    uint32_t interrupt_status = hal_save_and_disable_interrupts();
+    // Keep the scheduled packet unless Harp time has stepped past it (or
+    // back by more than a second).
+    uint64_t earliest_start_us =
+        self->system_to_harp_us_64_(hal_time_us_64())
+        + HARP_CLOCK_GEN_MIN_LEAD_US;
+    uint64_t start_us = sync_frame_start_harp_us(self->encoded_seconds_);
+    if ((start_us < earliest_start_us)
+        || (start_us - earliest_start_us >= 1'000'000ULL)
+        || !hal_alarm_set_target((unsigned int)self->alarm_num_,
+                                 self->harp_to_system_us_64_(start_us)))
+        self->schedule_next_packet();
+    hal_restore_interrupts(interrupt_status);
+}
+
+void HarpClockGenerator::alarm_callback(unsigned int /*alarm_num*/)
+{
+    if (!self->running_)
+        return;
+    // Check the packet against the current Harp time, which may have stepped
+    // (or been slewed away) since the packet was scheduled.
+    int64_t lateness_us =
+        int64_t(self->system_to_harp_us_64_(hal_time_us_64())
+                - sync_frame_start_harp_us(self->encoded_seconds_));
+    if ((lateness_us <= HARP_CLOCK_GEN_MAX_LATE_US)
+        && (lateness_us >= -HARP_CLOCK_GEN_MAX_LATE_US))
+    {
+        uint32_t seconds = self->encoded_seconds_;
+        uint8_t packet[HARP_SYNC_FRAME_SIZE] =
+            {HARP_SYNC_HEADER_0, HARP_SYNC_HEADER_1, uint8_t(seconds),
+             uint8_t(seconds >> 8), uint8_t(seconds >> 16),
+             uint8_t(seconds >> 24)};
+        hal_sync_uart_write(self->uart_id_, packet, sizeof(packet));
+        ++self->packets_sent_;
+    }
+    else
+        ++self->packets_skipped_;
+    self->schedule_next_packet();
+}
+
+void HarpClockGenerator::schedule_next_packet()
+{
+    // The packet announcing a second starts HARP_SYNC_EDGE_OFFSET_US before
+    // it, so find the first second whose packet starts far enough from now.
+    uint64_t earliest_start_us = system_to_harp_us_64_(hal_time_us_64())
+                                 + HARP_CLOCK_GEN_MIN_LEAD_US;
+    uint64_t second = hal_div_u64u64(earliest_start_us
+                                     + HARP_SYNC_EDGE_OFFSET_US, 1'000'000ULL)
+                      + 1;
+    // Retry with the following second if the alarm is already too late.
+    while (true)
+    {
+        // The packet encodes the previous second.
+        encoded_seconds_ = uint32_t(second - 1);
+        uint64_t start_us = sync_frame_start_harp_us(encoded_seconds_);
+        if (hal_alarm_set_target((unsigned int)alarm_num_,
+                                 harp_to_system_us_64_(start_us)))
+            return;
+        ++second;
+    }
+}
@@ -24,50 +24,117 @@ HarpCore::HarpCore(uint16_t who_am_i,
                    uint8_t fw_version_major, uint8_t fw_version_minor,
                    uint16_t serial_number, const char name[],
                    const uint8_t tag[])
-:regs_{who_am_i, hw_version_major, hw_version_minor, assembly_version,
-       harp_version_major, harp_version_minor,
-       fw_version_major, fw_version_minor, serial_number, name, tag},
- rx_buffer_index_{0}, total_bytes_read_{rx_buffer_index_}, new_msg_{false},
- set_visual_indicators_fn_{nullptr}, sync_{nullptr}, offset_us_64_{0},
+:new_msg_{false},
+ set_visual_indicators_fn_{nullptr}, sync_{nullptr}, sync_input_{nullptr},
+ clock_gen_{nullptr}, scheduler_{nullptr},
+ rx_read_index_{0}, rx_write_index_{0}, rx_msg_budget_{RX_MSG_BUDGET},
+ offset_us_64_{0}, timestamp_offset_us_{0}, event_latency_count_{0},
+ heartbeat_alarm_num_{-1}, next_heartbeat_s_{0},
+ heartbeat_interval_s_{HEARTBEAT_STANDBY_INTERVAL_US / 1'000'000UL},
+ heartbeat_pending_{false}, pending_heartbeat_s_{0},
  disconnect_handled_{false}, connect_handled_{false}, sync_handled_{false},
- heartbeat_interval_us_{HEARTBEAT_STANDBY_INTERVAL_US}
+ tx_flush_policy_{FLUSH_PER_RUN},
+ tx_coalesce_deadline_us_{TX_COALESCE_DEADLINE_US}, tx_pending_bytes_{0},
+ idle_policy_{IDLE_POLL}, rx_budget_spent_{false},
+ app_on_core1_{false}, core1_reset_pending_{false},
+ rx_last_byte_time_us_{0}, rx_arrival_count_{0}, rx_msg_time_us_{0},
+ rx_msg_harp_time_us_{0}, rx_resyncing_{false},
+ regs_{who_am_i, hw_version_major, hw_version_minor, assembly_version,
+       harp_version_major, harp_version_minor,
+       fw_version_major, fw_version_minor, serial_number, name, tag}
 {
+    static_assert(reg_func_table_is_complete(),
+                  "Every core register needs read and write handlers.");
+    static_assert((HEARTBEAT_ACTIVE_INTERVAL_US % 1'000'000UL == 0)
+                  && (HEARTBEAT_STANDBY_INTERVAL_US % 1'000'000UL == 0),
+                  "Heartbeats are issued on whole seconds.");
     // Create a pointer to the first (and one-and-only) instance created.
     if (self == nullptr)
         self = this;
-    tusb_init();
-#if defined(PICO_RP2040)
-    // Populate Harp Core R_UUID with unique id from QSPI Flash.
-    pico_unique_board_id_t unique_id;
-    pico_get_unique_board_id(&unique_id);
-    memcpy((void*)(&regs.R_UUID[8]), (void*)&(unique_id.id), sizeof(unique_id.id));
-#else
-#pragma warning("Harp Core Register UUID not autodetected for this board.")
-#endif
+    hal_cdc_init();
+    // Populate Harp Core R_UUID with unique id (i.e: from QSPI Flash).
+    uint8_t unique_id[HAL_UNIQUE_ID_SIZE];
+    hal_get_unique_board_id(unique_id);
+    memcpy((void*)(&regs.R_UUID[8]), (void*)unique_id, sizeof(unique_id));
     // Initialize next heartbeat.
-    // Round *up* to the nearest whole second.
-#if defined(PICO_RP2040)
-    uint32_t curr_time_us = uint32_t(harp_time_us_64());
-    uint32_t remainder;
-    uint32_t quotient = divmod_u32u32_rem(curr_time_us, 1'000'000UL,
-                                          &remainder);
-#else
-    uint32_t remainder = curr_time_us % 1'000'000UL;
-#endif
-    self->next_heartbeat_time_us_ = curr_time_us - remainder
-                                    + heartbeat_interval_us_;
+    heartbeat_alarm_num_ = hal_alarm_claim(heartbeat_alarm_callback);
+    restart_heartbeat();
 }
 
 HarpCore::~HarpCore(){self = nullptr;}
 
 void HarpCore::run()
 {
-    tud_task();
+    if (idle_policy_ == IDLE_SLEEP)
+        sleep_until_work();
+    hal_cdc_task();
     update_state();
-    update_app_state(); // Does nothing unless a derived class implements it.
+    // Does nothing unless a derived class implements it.
+    if (!app_on_core1_)
+        update_app_state();
     process_cdc_input();
-    if (not new_msg_)
+    // Handle every complete message in the rx buffer, up to the budget.
+    rx_budget_spent_ = true;
+    for (uint8_t i = 0; i < rx_msg_budget_; ++i)
+    {
+        if (!new_msg_ && !buffer_next_msg())
+        {
+            rx_budget_spent_ = false;
+            break;
+        }
+        handle_buffered_message();
+        // Leave unhandled messages (i.e: ones waiting for room in the core1
+        // queue) in the buffer and try again on the next call.
+        if (new_msg_)
+            break;
+        rx_read_index_ += get_buffered_msg_header().msg_size();
+    }
+    send_queued_events();
+    // Send any replies and events queued during this iteration, even if they
+    // do not fill a usb packet. When coalescing, only do so if the oldest
+    // queued message has waited long enough.
+    if (tx_flush_policy_ == FLUSH_PER_RUN)
+        flush_tx();
+    else if ((tx_flush_policy_ == FLUSH_COALESCE) && (tx_pending_bytes_ > 0)
+             && (hal_time_us_32() - tx_pending_start_time_us_)
+                >= tx_coalesce_deadline_us_)
+        flush_tx();
+}
+
+void HarpCore::sleep_until_work()
+{
+    // Interrupts that arrive from here on wake the core from the wait (even
+    // before it starts), so only work that is already waiting needs checking.
+    // Messages may be left over if the last run() call spent its budget.
+    if (rx_budget_spent_ || new_msg_ || (hal_cdc_available() > 0)
+        || heartbeat_pending_ || !event_queue_.empty()
+        || ((scheduler_ != nullptr) && HarpScheduler::has_events())
+        || (app_on_core1_ && !core1_tx_queue_.empty()))
         return;
+    // Wake up in time for the timeouts that run() polls for.
+    uint32_t curr_time_us = hal_time_us_32();
+    uint32_t sleep_us = HARP_IDLE_MAX_SLEEP_US;
+    if (rx_write_index_ > rx_read_index_) // a partial message.
+    {
+        uint32_t waited_us = curr_time_us - rx_last_byte_time_us_;
+        uint32_t left_us = (waited_us < RX_PARTIAL_MSG_TIMEOUT_US)?
+                               RX_PARTIAL_MSG_TIMEOUT_US - waited_us: 0;
+        sleep_us = (left_us < sleep_us)? left_us: sleep_us;
+    }
+    if ((tx_flush_policy_ == FLUSH_COALESCE) && (tx_pending_bytes_ > 0))
+    {
+        uint32_t waited_us = curr_time_us - tx_pending_start_time_us_;
+        uint32_t left_us = (waited_us < tx_coalesce_deadline_us_)?
+                               tx_coalesce_deadline_us_ - waited_us: 0;
+        sleep_us = (left_us < sleep_us)? left_us: sleep_us;
+    }
+    if (sleep_us == 0)
+        return;
+    hal_wait_for_event_until(hal_time_us_64() + sleep_us);
+}
+
+void HarpCore::handle_buffered_message()
+{
 #ifdef DEBUG_HARP_MSG_IN
     msg_t msg = get_buffered_msg();
     printf("Msg data: \r\n");
@@ -86,11 +153,24 @@ void HarpCore::run()
     }
     printf("\r\n\r\n");
 #endif
+    uint32_t wait_us = hal_time_us_32() - rx_msg_time_us_;
     // Handle in-range register msgs and clear them. Ignore out-of-range msgs.
     handle_buffered_core_message(); // Handle msg. Clear it if handled.
     if (not new_msg_)
+    {
+        record_rx_latency(wait_us);
         return;
+    }
+    if (app_on_core1_)
+    {
+        forward_buffered_app_message(); // Clear it if forwarded.
+        // Messages left for the next run() call have not been dispatched.
+        if (not new_msg_)
+            record_rx_latency(wait_us);
+        return;
+    }
     handle_buffered_app_message(); // Handle msg. Clear it if handled.
+    record_rx_latency(wait_us);
     // Always clear any unhandled messages, so we don't lock up.
     if (new_msg_)
     {
@@ -101,38 +181,229 @@ void HarpCore::run()
     }
 }
 
+void HarpCore::record_rx_latency(uint32_t wait_us)
+{
+    volatile RxLatency& latency = regs.R_RX_LATENCY;
+    latency.messages = latency.messages + 1;
+    latency.last_wait_us = wait_us;
+    if (wait_us > latency.max_wait_us)
+        latency.max_wait_us = wait_us;
+    latency.total_wait_us = latency.total_wait_us + wait_us;
+}
+
+void HarpCore::send_queued_events()
+{
+    if (heartbeat_pending_)
+    {
+        // Take the heartbeat so that the alarm can issue the next one.
+        uint32_t interrupt_status = hal_save_and_disable_interrupts();
+        uint32_t heartbeat_s = pending_heartbeat_s_;
+        heartbeat_pending_ = false;
+        hal_restore_interrupts(interrupt_status);
+        send_heartbeat(heartbeat_s);
+    }
+    {
+        decltype(event_queue_)::event_t event;
+        while (event_queue_.pop(event))
+        {
+            if (!events_enabled())
+                continue;
+            send_harp_reply(event.type, event.address, event.payload,
+                            event.num_bytes, event.payload_type,
+                            event.harp_time_us);
+        }
+        // Events posted by the scheduler's alarm have their own queue.
+        while ((scheduler_ != nullptr) && HarpScheduler::pop_event(event))
+        {
+            if (!events_enabled())
+                continue;
+            send_harp_reply(event.type, event.address, event.payload,
+                            event.num_bytes, event.payload_type,
+                            event.harp_time_us);
+        }
+    }
+    if (!app_on_core1_)
+        return;
+    // Send replies and events issued by the app on core1.
+    decltype(core1_tx_queue_)::event_t reply;
+    while (core1_tx_queue_.pop(reply))
+        send_harp_reply(reply.type, reply.address, reply.payload,
+                        reply.num_bytes, reply.payload_type,
+                        reply.harp_time_us);
+}
+
+void HarpCore::launch_app_on_core1()
+{
+    self->app_on_core1_ = true;
+    hal_launch_core1(core1_main);
+}
+
+void HarpCore::core1_main()
+{
+    while (true)
+        self->run_core1();
+}
+
+void HarpCore::run_core1()
+{
+    if (core1_reset_pending_.load(std::memory_order_acquire))
+    {
+        reset_app();
+        core1_reset_pending_.store(false, std::memory_order_release);
+    }
+    update_app_state(); // Does nothing unless a derived class implements it.
+    // Handle all app messages forwarded from core0.
+    decltype(core1_rx_queue_)::event_t event;
+    while (core1_rx_queue_.pop(event))
+    {
+        // Rebuild a message that refers to the queued copy.
+        msg_header_t header{event.type, uint8_t(event.num_bytes + 4),
+                            event.address, 255, event.payload_type};
+        uint8_t checksum = 0; // Already consumed by core0.
+        msg_t msg{header, event.payload, checksum, event.harp_time_us};
+        handle_app_message(msg);
+    }
+}
+
+void HarpCore::forward_buffered_app_message()
+{
+    msg_t msg = get_buffered_msg();
+    // Messages that can never fit in the queue are refused with an error
+    // reply. Its payload is left empty, since core0 does not know if the
+    // address is one of the app's registers.
+    if (msg.payload_length() > HARP_CORE1_MAX_PAYLOAD_SIZE)
+    {
+        volatile RxErrors& errors = regs.R_RX_ERRORS;
+        errors.oversize_msgs = errors.oversize_msgs + 1;
+        msg_type_t error_type = (msg.header.type == WRITE)?
+                                    WRITE_ERROR: READ_ERROR;
+        send_harp_reply(error_type, msg.header.address, nullptr, 0,
+                        msg.header.payload_type);
+        clear_msg();
+        return;
+    }
+    if (core1_rx_queue_.full())
+        return; // Try again on the next run() call.
+    core1_rx_queue_.push(msg.header.type, msg.header.address,
+                         (uint8_t*)msg.payload, msg.payload_length(),
+                         msg.header.payload_type, msg.rx_harp_time_us);
+    clear_msg();
+}
+
 void HarpCore::process_cdc_input()
 {
-    // TODO: Consider a timeout if we never receive a fully formed message.
-    // TODO: scan for partial messages.
-    // Fetch all data in the serial port. If it's at least a header's worth,
-    // check the payload size and keep reading up to the end of the packet.
-    if (not tud_cdc_available())
+    // Fetch all data in the serial port that fits in the rx buffer.
+    if (not hal_cdc_available())
         return;
-    // If the header has arrived, only read up to the full payload so we can
-    // process one message at a time.
-    uint32_t max_bytes_to_read = sizeof(rx_buffer_) - rx_buffer_index_;
-    if (total_bytes_read_ >= sizeof(msg_header_t))
+    // Shift unhandled bytes (at most one partial message plus any messages
+    // left over from the last run() call) to the front of the buffer to make
+    // room.
+    if (rx_read_index_ > 0)
     {
-        // Reinterpret contents of the rx buffer as a message header.
-        msg_header_t& header = get_buffered_msg_header();
-        // Read only the remainder of a single harp message.
-        max_bytes_to_read = header.msg_size() - total_bytes_read_;
+        // Forget reads whose bytes have all been handled.
+        uint8_t count = 0;
+        for (uint8_t i = 0; i < rx_arrival_count_; ++i)
+        {
+            if (rx_arrivals_[i].end_index <= rx_read_index_)
+                continue;
+            rx_arrivals_[count] = rx_arrivals_[i];
+            rx_arrivals_[count].end_index -= rx_read_index_;
+            ++count;
+        }
+        rx_arrival_count_ = count;
+        rx_write_index_ -= rx_read_index_;
+        memmove(rx_buffer_, rx_buffer_ + rx_read_index_, rx_write_index_);
+        rx_read_index_ = 0;
     }
-    uint32_t bytes_read = tud_cdc_read(&(rx_buffer_[rx_buffer_index_]),
-                                       max_bytes_to_read);
-    rx_buffer_index_ += bytes_read;
-    // See if we have a message header's worth of data yet. Baily early if not.
-    if (total_bytes_read_ < sizeof(msg_header_t))
+    uint16_t max_bytes_to_read = sizeof(rx_buffer_) - rx_write_index_;
+    if (max_bytes_to_read == 0)
         return;
-    // Reinterpret contents of the rx buffer as a message header.
-    msg_header_t& header = get_buffered_msg_header();
-    // Bail early if the full message (with payload) has not fully arrived.
-    if (total_bytes_read_ < header.msg_size())
+    uint32_t bytes_read = hal_cdc_read(rx_buffer_ + rx_write_index_,
+                                       max_bytes_to_read);
+    if (bytes_read == 0)
         return;
-    rx_buffer_index_ = 0; // Reset buffer index for the next message.
-    new_msg_ = true;
-    return;
+    rx_write_index_ += bytes_read;
+    rx_last_byte_time_us_ = hal_time_us_32();
+    // Remember when these bytes arrived. If out of slots, merge the oldest
+    // read into the next one by dropping it (each read's bytes start where
+    // the previous one's ends).
+    if (rx_arrival_count_ == RX_ARRIVAL_SLOTS)
+    {
+        for (uint8_t i = 0; i < RX_ARRIVAL_SLOTS - 1; ++i)
+            rx_arrivals_[i] = rx_arrivals_[i + 1];
+        --rx_arrival_count_;
+    }
+    uint64_t harp_time_us = system_to_harp_us_64(
+        extend_time_us_32(rx_last_byte_time_us_, hal_time_us_64()));
+    rx_arrivals_[rx_arrival_count_++] = {rx_write_index_,
+                                         rx_last_byte_time_us_, harp_time_us};
+}
+
+bool HarpCore::buffer_next_msg()
+{
+    volatile RxErrors& errors = regs.R_RX_ERRORS;
+    while (rx_read_index_ < rx_write_index_)
+    {
+        uint16_t unread_bytes = rx_write_index_ - rx_read_index_;
+        // Reinterpret contents of the rx buffer as a (possibly partial)
+        // message header.
+        msg_header_t& header = get_buffered_msg_header();
+        bool skip_byte = false;
+        if (!header.is_plausible(unread_bytes))
+        {
+            skip_byte = true;
+            if (!rx_resyncing_)
+                errors.framing_errors = errors.framing_errors + 1;
+        }
+        else if (unread_bytes < sizeof(msg_header_t)
+                 || unread_bytes < header.msg_size())
+        {
+            // Bail early if the full message has not arrived yet unless it
+            // never will.
+            if ((hal_time_us_32() - rx_last_byte_time_us_)
+                < RX_PARTIAL_MSG_TIMEOUT_US)
+                return false;
+            skip_byte = true;
+            if (!rx_resyncing_)
+                errors.timeouts = errors.timeouts + 1;
+        }
+        else
+        {
+            // Checksum is the (truncated) sum of all preceding bytes.
+            uint8_t* msg_start = rx_buffer_ + rx_read_index_;
+            uint16_t checksum_index = header.checksum_index_offset();
+            uint8_t checksum = 0;
+            for (uint16_t i = 0; i < checksum_index; ++i)
+                checksum += msg_start[i];
+            if (checksum != msg_start[checksum_index])
+            {
+                skip_byte = true;
+                if (!rx_resyncing_)
+                    errors.checksum_errors = errors.checksum_errors + 1;
+            }
+        }
+        if (skip_byte)
+        {
+            // Slide forward to the next byte that could start a message.
+            rx_resyncing_ = true;
+            ++rx_read_index_;
+            errors.dropped_bytes = errors.dropped_bytes + 1;
+            continue;
+        }
+        rx_resyncing_ = false;
+        // Find the read that delivered the message's last byte. The newest
+        // read always ends at the #rx_write_index_.
+        uint16_t msg_end_index = rx_read_index_ + header.msg_size();
+        uint8_t i = 0;
+        while ((i < rx_arrival_count_ - 1)
+               && (rx_arrivals_[i].end_index < msg_end_index))
+            ++i;
+        rx_msg_time_us_ = rx_arrivals_[i].time_us;
+        rx_msg_harp_time_us_ = rx_arrivals_[i].harp_time_us;
+        new_msg_ = true;
+        return true;
+    }
+    return false;
 }
 
 msg_t HarpCore::get_buffered_msg()
@@ -140,27 +411,29 @@ msg_t HarpCore::get_buffered_msg()
     // Reinterpret (i.e: type pun) contents of the uart rx buffer as a message.
     // Use references and ptrs to existing data so we don't make any copies.
     msg_header_t& header = get_buffered_msg_header();
-    void* payload = rx_buffer_ + header.payload_base_index_offset();
-    uint8_t& checksum = *(rx_buffer_ + header.checksum_index_offset());
-    return msg_t{header, payload, checksum};
+    uint8_t* msg_start = rx_buffer_ + rx_read_index_;
+    void* payload = msg_start + header.payload_base_index_offset();
+    uint8_t& checksum = *(msg_start + header.checksum_index_offset());
+    return msg_t{header, payload, checksum, rx_msg_harp_time_us_};
 }
 
 void HarpCore::handle_buffered_core_message()
 {
     msg_t msg = get_buffered_msg();
-    // TODO: check checksum.
+    // Note: checksum has already been checked in buffer_next_msg().
     // Note: PC-to-Harp msgs don't have timestamps, so we don't check for them.
     // Ignore out-of-range messages. Expect them to be handled by derived class.
-    if (msg.header.address > CORE_REG_COUNT)
+    uint8_t index = core_reg_index(msg.header.address);
+    if (index >= CORE_REG_COUNT)
         return;
     // Handle read-or-write behavior.
     switch (msg.header.type)
     {
         case READ:
-            reg_func_table_[msg.header.address].read_fn_ptr(msg.header.address);
+            reg_func_table_[index].read_fn_ptr(msg.header.address);
             break;
         case WRITE:
-            reg_func_table_[msg.header.address].write_fn_ptr(msg);
+            reg_func_table_[index].write_fn_ptr(msg);
             break;
     }
     clear_msg();
@@ -169,12 +442,12 @@ void HarpCore::handle_buffered_core_message()
 void HarpCore::update_state(bool force, op_mode_t forced_next_state)
 {
     // Update internal logic.
-    uint32_t curr_time_us = uint32_t(harp_time_us_64());
-    bool tud_cdc_is_connected = tud_cdc_connected(); // Compute this once.
+    uint32_t curr_time_us = harp_time_us_32();
+    bool tud_cdc_is_connected = hal_cdc_connected(); // Compute this once.
+    // Release the sync lock if the external clock has gone quiet.
+    if (self->sync_ != nullptr)
+        self->sync_->update();
     bool is_synced = self->is_synced(); // Compute this once
-    // Preserve flag value when synced; clear flag if we unsync.
-    self->sync_handled_ = is_synced?
-                              self->sync_handled_: false;
     // Extra logic so that we only act on the connection/disconnection event
     // changes once. State changes are connection/disconnection dependendent,
     // but after connecting, the PC is able to override the state at any point.
@@ -186,25 +459,22 @@ void HarpCore::update_state(bool force, op_mode_t forced_next_state)
         self->disconnect_handled_ = true;
         self->disconnect_start_time_us_ = curr_time_us;
     }
-    // Extra logic to handle behavior that happens upon synchronizing.
-    if (is_synced && !self->sync_handled_)
-    {
-        // Recompute next whole second (in [us]) based on synchronized time.
-        // Round *up* to the nearest whole second.
-#if defined(PICO_RP2040)
-        uint32_t remainder;
-        uint32_t quotient = divmod_u32u32_rem(curr_time_us, 1'000'000UL,
-                                              &remainder);
-#else
-        uint32_t remainder = curr_time_us % 1'000'000UL;
-#endif
-        self->next_heartbeat_time_us_ = curr_time_us - remainder
-                                        + self->heartbeat_interval_us_;
-        self->sync_handled_ = true;
+    // Extra logic to handle behavior that happens upon gaining or losing the
+    // lock to the external clock.
+    if (is_synced != self->sync_handled_)
+    {
+        self->sync_handled_ = is_synced;
+        self->regs_.r_clock_config_bits.CLK_LOCK = is_synced;
+        self->regs_.r_clock_config_bits.CLK_UNLOCK = !is_synced;
+        // Start or stop repeating the clock input.
+        update_clock_output();
+        // Report the change so the PC can flag data timestamped in holdover.
+        if (events_enabled())
+            send_harp_reply(EVENT, CLOCK_CONFIG);
     }
     // Update state machine "next-state" logic.
     const uint8_t& state = self->regs_.r_operation_ctrl_bits.OP_MODE;
-    uint8_t next_state = force? forced_next_state: state;
+    uint8_t next_state = force? uint8_t(forced_next_state): state;
     if (!force)
     {
         switch (state)
@@ -231,50 +501,103 @@ void HarpCore::update_state(bool force, op_mode_t forced_next_state)
     if ((state != ACTIVE) && (next_state == ACTIVE))
     {
         self->connect_handled_ = true;
-        self->heartbeat_interval_us_ = HEARTBEAT_ACTIVE_INTERVAL_US;
+        self->heartbeat_interval_s_ = HEARTBEAT_ACTIVE_INTERVAL_US
+                                      / 1'000'000UL;
+        // Send the first heartbeat on the next whole second.
+        restart_heartbeat();
     }
     if (state == ACTIVE && next_state == STANDBY)
     {
-        self->heartbeat_interval_us_ = HEARTBEAT_STANDBY_INTERVAL_US;
+        self->heartbeat_interval_s_ = HEARTBEAT_STANDBY_INTERVAL_US
+                                      / 1'000'000UL;
     }
     // Handle OPERATION_CTRL behavior.
-    if (int32_t(curr_time_us - self->next_heartbeat_time_us_) >= 0)
+    // Heartbeats are issued from the heartbeat alarm unless none was free.
+    uint32_t heartbeat_s;
+    if ((self->heartbeat_alarm_num_ < 0) && take_due_heartbeat(heartbeat_s)
+        && heartbeat_enabled())
     {
-        self->next_heartbeat_time_us_ += self->heartbeat_interval_us_;
-        // Dispatch heartbeat msg and Blink LED.
-        if (self->regs_.r_operation_ctrl_bits.ALIVE_EN)
-        {
-            //if (self->regs_.r_operation_ctrl_bits.VISUALEN)
-            //    set_led(!get_led);
-            if ((state == ACTIVE) & !is_muted()) // i.e: events enabled
-                send_harp_reply(EVENT, TIMESTAMP_SECOND);
-        }
+        send_heartbeat(heartbeat_s);
     }
     // Handle in-state dependent output logic.
     // Do the state transition.
     self->regs_.r_operation_ctrl_bits.OP_MODE = next_state;
 }
 
-const RegSpecs& HarpCore::reg_address_to_specs(uint8_t address)
+RegSpecs HarpCore::reg_address_to_specs(uint8_t address)
 {
-    if (address < CORE_REG_COUNT)
-        return regs_.address_to_specs[address];
+    uint8_t index = core_reg_index(address);
+    if (index < CORE_REG_COUNT)
+        return regs_.specs(index);
     return address_to_app_reg_specs(address); // virtual. Implemented by app.
 }
 
-void HarpCore::send_harp_reply(msg_type_t reply_type, uint8_t reg_name,
-                               const volatile uint8_t* data, uint8_t num_bytes,
-                               reg_type_t payload_type, uint64_t harp_time_us)
+uint16_t HarpCore::build_harp_frame(uint8_t* frame, msg_type_t reply_type,
+                                    uint8_t reg_name,
+                                    const volatile uint8_t* data,
+                                    uint8_t num_bytes, reg_type_t payload_type,
+                                    uint64_t harp_time_us)
 {
-    // FIXME: implementation as-is cannot send more than 64 bytes of data
-    //  because of underlying usb implementation.
-    // Dispatch timestamped Harp reply.
     // Note: This fn implementation assumes little-endian architecture.
     uint8_t raw_length = num_bytes + 10;
     uint8_t checksum = 0;
+    uint16_t index = 0;
     msg_header_t header{reply_type, raw_length, reg_name, 255,
                         (reg_type_t)(HAS_TIMESTAMP | payload_type)};
+    // Serialize header, timestamp, and payload while accumulating the checksum
+    // in the same pass.
+    for (uint8_t i = 0; i < sizeof(header); ++i) // push the header.
+    {
+        uint8_t byte = *(((uint8_t*)(&header)) + i);
+        checksum += byte;
+        frame[index++] = byte;
+    }
+    // Push the timestamp. Encode it straight into the frame so that the
+    // timestamp registers are left alone.
+    self->timestamp_encoder_.encode(harp_time_us, frame + index);
+    for (uint8_t i = 0; i < HARP_TIMESTAMP_SIZE; ++i)
+        checksum += frame[index++];
+    // TODO: should we lockout global interrupts to prevent reg data from
+    //  changing underneath us?
+    for (uint8_t i = 0; i < num_bytes; ++i) // push the payload data.
+    {
+        uint8_t byte = data[i];
+        checksum += byte;
+        frame[index++] = byte;
+    }
+    frame[index++] = checksum; // push the checksum.
+    return index;
+}
+
+void HarpCore::send_harp_reply(msg_type_t reply_type, uint8_t reg_name,
+                               const volatile uint8_t* data, uint8_t num_bytes,
+                               reg_type_t payload_type, uint64_t harp_time_us)
+{
+    // In dual-core mode, tinyusb is owned by core0. Pass replies issued from
+    // core1 to core0 to be sent.
+    if (self->app_on_core1_ && (hal_get_core_num() == 1))
+    {
+        while (self->core1_tx_queue_.full())
+            hal_tight_loop_contents(); // Wait for core0 to send pending replies.
+        self->core1_tx_queue_.push(reply_type, reg_name, data, num_bytes,
+                                   payload_type, harp_time_us);
+        wake();
+        return;
+    }
+    // Compensate for R_TIMESTAMP_OFFSET and, for events, for their source's
+    // latency.
+    uint32_t compensation_us = self->timestamp_offset_us_;
+    if ((reply_type == EVENT) && (self->event_latency_count_ > 0))
+        compensation_us += event_latency_us(reg_name);
+    harp_time_us = (harp_time_us > compensation_us)?
+                       harp_time_us - compensation_us: 0;
+    // Dispatch timestamped Harp reply.
+    uint8_t frame[MAX_TIMESTAMPED_MSG_SIZE];
+    uint16_t frame_size = build_harp_frame(frame, reply_type, reg_name, data,
+                                           num_bytes, payload_type,
+                                           harp_time_us);
 #ifdef DEBUG_HARP_MSG_OUT
+    msg_header_t& header = *((msg_header_t*)frame);
     printf("Sending msg: \r\n");
     printf("  type: %d\r\n", header.type);
     printf("  addr: %d\r\n", header.address);
@@ -291,40 +614,61 @@ void HarpCore::send_harp_reply(msg_type_t reply_type, uint8_t reg_name,
     }
     printf("\r\n\r\n");
 #endif
-    // Push data into usb packet and send it.
-    for (uint8_t i = 0; i < sizeof(header); ++i) // push the header.
-    {
-        uint8_t& byte = *(((uint8_t*)(&header))+i);
-        checksum += byte;
-        tud_cdc_write_char(byte);
-    }
-    self->set_timestamp_regs(harp_time_us); // update and push timestamp.
-    for (uint8_t i = 0; i < sizeof(self->regs.R_TIMESTAMP_SECOND); ++i)
-    {
-        uint8_t& byte = *(((uint8_t*)(&self->regs.R_TIMESTAMP_SECOND)) + i);
-        checksum += byte;
-        tud_cdc_write_char(byte);
-    }
-    for (uint8_t i = 0; i < sizeof(self->regs.R_TIMESTAMP_MICRO); ++i)
-    {
-        uint8_t& byte = *(((uint8_t*)(&self->regs.R_TIMESTAMP_MICRO)) + i);
-        checksum += byte;
-        tud_cdc_write_char(byte);
-    }
-    // TODO: should we lockout global interrupts to prevent reg data from
-    //  changing underneath us?
-    for (uint8_t i = 0; i < num_bytes; ++i) // push the payload data.
+    self->write_frame(frame, frame_size);
+}
+
+void HarpCore::send_heartbeat(uint32_t heartbeat_s)
+{
+    // The heartbeat marks the whole second itself, so it skips the
+    // compensation in send_harp_reply().
+    uint8_t frame[MAX_TIMESTAMPED_MSG_SIZE];
+    uint16_t frame_size = build_harp_frame(frame, EVENT, TIMESTAMP_SECOND,
+                                           (uint8_t*)&heartbeat_s,
+                                           sizeof(heartbeat_s), U32,
+                                           uint64_t(heartbeat_s)
+                                           * 1'000'000ULL);
+    self->write_frame(frame, frame_size);
+}
+
+void HarpCore::write_frame(const uint8_t* frame, uint16_t frame_size)
+{
+    volatile TxStats& stats = regs.R_TX_STATS;
+    // Commit whole frames only. If the tx FIFO cannot fit the frame, push out
+    // what is queued and give tinyusb a chance to make room.
+    uint32_t start_time_us = hal_time_us_32();
+    while (hal_cdc_write_available() < frame_size)
     {
-        const volatile uint8_t& byte = *(data + i);
-        checksum += byte;
-        tud_cdc_write_char(byte);
+        if (!hal_cdc_connected() ||
+            (hal_time_us_32() - start_time_us) >= TX_FIFO_FULL_TIMEOUT_US)
+        {
+            stats.dropped_frames = stats.dropped_frames + 1;
+            return;
+        }
+        flush_tx();
+        hal_cdc_task();
     }
-    tud_cdc_write_char(checksum); // push the checksum.
-    tud_cdc_write_flush();  // Send usb packet, even if not full.
-    // Call tud_task to handle case we issue multiple harp replies in a row.
-    // FIXME: a better way might be to check tinyusb's internal buffer's
-    // remaining space.
-    tud_task();
+    hal_cdc_write(frame, frame_size);
+    // Track how the frame packs into usb packets. Tinyusb sends a packet as
+    // soon as it is full.
+    uint16_t queued_bytes = tx_pending_bytes_ + frame_size;
+    if ((tx_pending_bytes_ == 0) || (queued_bytes >= USBD_CDC_IN_OUT_MAX_SIZE))
+        tx_pending_start_time_us_ = start_time_us;
+    stats.full_packets = stats.full_packets
+                         + queued_bytes / USBD_CDC_IN_OUT_MAX_SIZE;
+    tx_pending_bytes_ = queued_bytes % USBD_CDC_IN_OUT_MAX_SIZE;
+    stats.frames = stats.frames + 1;
+    stats.bytes = stats.bytes + frame_size;
+    if (tx_flush_policy_ == FLUSH_PER_MSG)
+        flush_tx(); // Send usb packet, even if not full.
+}
+
+void HarpCore::flush_tx()
+{
+    hal_cdc_write_flush();
+    if (tx_pending_bytes_ == 0)
+        return;
+    regs.R_TX_STATS.short_packets = regs.R_TX_STATS.short_packets + 1;
+    tx_pending_bytes_ = 0;
 }
 
 void HarpCore::read_reg_generic(uint8_t reg_name)
@@ -354,27 +698,66 @@ void HarpCore::write_to_read_only_reg_error(msg_t& msg)
 
 void HarpCore::set_timestamp_regs(uint64_t harp_time_us)
 {
-    // RP2040 implementation:
-    // Harp Time is computed as an offset relative to the RP2040's main
-    // timer register, which ticks every 1[us].
+    // Harp Time is computed as an offset relative to the device's main
+    // timer (i.e: the RP2040's timer register), which ticks every 1[us].
     // Note: R_TIMESTAMP_MICRO can only represent values up to 31249.
-    // Note: Update microseconds first.
-#if defined(PICO_RP2040)
-    uint64_t leftover_microseconds;
-    uint64_t curr_seconds = divmod_u64u64_rem(harp_time_us, 1'000'000UL,
-                                              &leftover_microseconds);
-    self->regs.R_TIMESTAMP_SECOND = uint32_t(curr_seconds); // will not overflow.
-    self->regs.R_TIMESTAMP_MICRO = uint16_t(leftover_microseconds >> 5);
-#else
-    uint64_t& curr_microseconds = harp_time_us;
-    self->regs.R_TIMESTAMP_SECOND = curr_microseconds / 1'000'000ULL;
-    self->regs.R_TIMESTAMP_MICRO = uint16_t((curr_microseconds % 1'000'000UL)>>5);
-#endif
+    uint32_t offset_us = self->timestamp_offset_us_;
+    harp_time_us = (harp_time_us > offset_us)? harp_time_us - offset_us: 0;
+    uint32_t seconds;
+    uint16_t ticks;
+    self->timestamp_encoder_.encode(harp_time_us, seconds, ticks);
+    self->regs.R_TIMESTAMP_SECOND = seconds;
+    self->regs.R_TIMESTAMP_MICRO = ticks;
 }
 
 void HarpCore::read_timestamp_second(uint8_t reg_name)
 {
-    self->update_timestamp_regs();
+    send_timestamp_reg_reply(READ, reg_name);
+}
+
+void HarpCore::read_event_queue_stats(uint8_t reg_name)
+{
+    // Update register. Then trigger a generic register read.
+    volatile EventQueueStats& stats = self->regs.R_EVENT_QUEUE_STATS;
+    stats.posted = self->event_queue_.posted();
+    stats.dropped = self->event_queue_.dropped();
+    stats.high_water = self->event_queue_.high_water();
+    stats.capacity = self->event_queue_.capacity();
+    read_reg_generic(reg_name);
+}
+
+void HarpCore::read_sync_quality(uint8_t reg_name)
+{
+    // Update register (if we have a synchronizer). Then trigger a generic
+    // register read.
+    if (self->sync_ != nullptr)
+    {
+        HarpSynchronizer::SyncStats sync_stats = self->sync_->stats();
+        volatile SyncQuality& quality = self->regs.R_SYNC_QUALITY;
+        quality.last_residual_ns = sync_stats.last_residual_ns;
+        quality.mean_residual_ns = sync_stats.mean_residual_ns;
+        quality.jitter_ns = sync_stats.jitter_ns;
+        quality.drift_ppb = sync_stats.drift_ppb;
+    }
+    read_reg_generic(reg_name);
+}
+
+void HarpCore::read_sync_counters(uint8_t reg_name)
+{
+    // Update register (if we have a synchronizer). Then trigger a generic
+    // register read.
+    if (self->sync_ != nullptr)
+    {
+        HarpSynchronizer::SyncStats sync_stats = self->sync_->stats();
+        volatile SyncCounters& counters = self->regs.R_SYNC_COUNTERS;
+        counters.packets_received = sync_stats.packets_received;
+        counters.packets_rejected = sync_stats.packets_rejected;
+        // Saturate since the age only fits ~49 days in [ms].
+        uint64_t sync_age_ms = hal_div_u64u64(sync_stats.sync_age_us, 1'000);
+        counters.sync_age_ms = (sync_age_ms > UINT32_MAX)?
+                                   UINT32_MAX: uint32_t(sync_age_ms);
+        counters.lock_losses = sync_stats.lock_losses;
+    }
     read_reg_generic(reg_name);
 }
 
@@ -384,48 +767,39 @@ void HarpCore::write_timestamp_second(msg_t& msg)
     // Replace the current number of elapsed seconds without altering the
     // number of elapsed microseconds.
     uint64_t set_time_microseconds = uint64_t(seconds) * 1000000UL;
-#if defined(PICO_RP2040)
     uint64_t curr_microseconds;
-    uint64_t curr_seconds = divmod_u64u64_rem(time_us_64(), 1'000'000ULL,
-                                              &curr_microseconds);
-#else
-    uint64_t curr_microseconds = time_us_64() % 1000000ULL;
-#endif
+    hal_divmod_u64u64_rem(harp_time_us_64(), 1'000'000ULL, &curr_microseconds);
     uint64_t new_harp_time_us = set_time_microseconds + curr_microseconds;
     // If synchronizer is attached, also update the synchronizer's time.
     set_harp_time_us_64(new_harp_time_us);
-    // Send harp reply.
-    // Note: harp timestamp registers will be updated before being dispatched.
-    send_harp_reply(WRITE, msg.header.address);
+    send_timestamp_reg_reply(WRITE, msg.header.address);
 }
 
 void HarpCore::read_timestamp_microsecond(uint8_t reg_name)
 {
-    // Update register. Then trigger a generic register read.
-    self->update_timestamp_regs();
-    read_reg_generic(reg_name);
+    send_timestamp_reg_reply(READ, reg_name);
 }
 
 void HarpCore::write_timestamp_microsecond(msg_t& msg)
 {
     const uint32_t msg_us = ((uint32_t)(*((uint16_t*)msg.payload))) << 5;
-    // PICO implementation: replace the current number of elapsed microseconds
-    // with the value received from the message.
-
-#if defined(PICO_RP2040)
-    uint64_t curr_total_s  = div_u64u64(time_us_64(), 1'000'000ULL);
-#else
-    uint64_t curr_total_s  = time_us_64() / 1'000'000ULL;
-#endif
-    uint64_t new_harp_time_us = curr_total_s + msg_us;
+    // Replace the current number of elapsed microseconds without altering
+    // the number of elapsed seconds.
+    uint64_t curr_seconds = hal_div_u64u64(harp_time_us_64(), 1'000'000ULL);
+    uint64_t new_harp_time_us = curr_seconds * 1'000'000ULL + msg_us;
     // If synchronizer is attached, also update the synchronizer's time.
     set_harp_time_us_64(new_harp_time_us);
-    if (self->sync_ != nullptr)
-        self->sync_->set_harp_time_us_64(new_harp_time_us);
-    self->offset_us_64_ = time_us_64() - new_harp_time_us;
-    // Send harp reply.
-    // Note: Harp timestamp registers will be updated before dispatching reply.
-    send_harp_reply(WRITE, msg.header.address);
+    send_timestamp_reg_reply(WRITE, msg.header.address);
+}
+
+void HarpCore::send_timestamp_reg_reply(msg_type_t reply_type,
+                                        uint8_t reg_name)
+{
+    // Update both timestamp registers and the reply's timestamp with the
+    // same time, so that the payload matches the timestamp.
+    uint64_t harp_time_us = harp_time_us_64();
+    set_timestamp_regs(harp_time_us);
+    send_harp_reply(reply_type, reg_name, harp_time_us);
 }
 
 void HarpCore::write_operation_ctrl(msg_t& msg)
@@ -448,12 +822,14 @@ void HarpCore::write_operation_ctrl(msg_t& msg)
     // Send WRITE reply.
     send_harp_reply(WRITE, msg.header.address);
     // DUMP-bit-specific behavior: if set, dispatch one READ reply per register.
+    // Go through each register's read handler so that registers refreshed on
+    // read (timestamp, queue stats, sync telemetry) are dumped current.
     // Apps must also dump their registers.
     if (DUMP)
     {
-        for (uint8_t address = 0; address < CORE_REG_COUNT; ++address)
+        for (uint8_t index = 0; index < CORE_REG_COUNT; ++index)
         {
-            send_harp_reply(READ, address);
+            reg_func_table_[index].read_fn_ptr(core_reg_address(index));
         }
         self->dump_app_registers();
     }
@@ -470,17 +846,17 @@ void HarpCore::write_reset_dev(msg_t& msg)
     // Issue a harp reply only if we aren't resetting.
     // TODO: unclear if this is the appropriate behavior.
     // Reset if specified to do so.
-#if defined(PICO_RP2040)
     if (reset_dfu_bit)
-        reset_usb_boot(0,0);
-#else
-#pragma warning("Boot-to-DFU-mode via Harp Protocol not supported for this device.")
-#endif
+        hal_reset_to_bootloader();
     if (rst_dev_bit)
     {
         // Reset core state machine and app.
         self->regs_.r_operation_ctrl_bits.OP_MODE = STANDBY;
-        self->reset_app();
+        // In dual-core mode, the app is reset from core1.
+        if (self->app_on_core1_)
+            self->core1_reset_pending_.store(true, std::memory_order_release);
+        else
+            self->reset_app();
     }
     else
         send_harp_reply(WRITE, msg.header.address);
@@ -504,13 +880,228 @@ void HarpCore::write_serial_number(msg_t& msg)
 
 void HarpCore::write_clock_config(msg_t& msg)
 {
-    // TODO.
-    write_reg_generic(msg);
+    uint8_t& write_byte = *((uint8_t*)msg.payload);
+    // Capability and lock status bits are read-only.
+    const uint8_t read_only_mask = (1u << REP_ABLE_OFFSET)
+                                   | (1u << GEN_ABLE_OFFSET)
+                                   | (1u << CLK_UNLOCK_OFFSET)
+                                   | (1u << CLK_LOCK_OFFSET);
+    self->regs.R_CLOCK_CONFIG = (self->regs.R_CLOCK_CONFIG & read_only_mask)
+                                | (write_byte & ~read_only_mask);
+    update_clock_output();
+    if (self->is_muted())
+        return;
+    send_harp_reply(WRITE, msg.header.address);
+}
+
+void HarpCore::update_clock_output()
+{
+    ClockConfigBits& clock_config = self->regs_.r_clock_config_bits;
+    // Generating takes precedence over repeating.
+    bool generate = clock_config.CLK_GEN && clock_config.GEN_ABLE;
+    bool repeat = !generate && clock_config.CLK_REP && clock_config.REP_ABLE;
+    clock_config.CLK_GEN = generate;
+    clock_config.CLK_REP = repeat;
+    if (self->clock_gen_ == nullptr)
+        return;
+    // Ignore the clock input while we are the clock source. Carry on from the
+    // current Harp time. Either switch changes how Harp time maps to system
+    // time, so alarms armed in Harp time must be re-armed.
+    if (generate && (self->sync_ != nullptr))
+    {
+        self->offset_us_64_ = hal_time_us_64() - harp_time_us_64();
+        self->sync_input_ = self->sync_;
+        self->sync_ = nullptr;
+        clock_changed();
+    }
+    else if (!generate && (self->sync_input_ != nullptr))
+    {
+        self->sync_ = self->sync_input_;
+        self->sync_input_ = nullptr;
+        clock_changed();
+    }
+    // Only repeat the clock input while locked to it. Otherwise, downstream
+    // devices would lock to our holdover.
+    bool send = generate || (repeat && is_synced());
+    if (send && !HarpClockGenerator::is_running())
+        HarpClockGenerator::start();
+    else if (!send && HarpClockGenerator::is_running())
+        HarpClockGenerator::stop();
+}
+
+void HarpCore::update_clock_capabilities()
+{
+    ClockConfigBits& clock_config = self->regs_.r_clock_config_bits;
+    clock_config.GEN_ABLE = (self->clock_gen_ != nullptr)
+                            && self->clock_gen_->is_available();
+    clock_config.REP_ABLE = clock_config.GEN_ABLE
+                            && ((self->sync_ != nullptr)
+                                || (self->sync_input_ != nullptr));
+}
+
+void HarpCore::set_synchronizer(HarpSynchronizer* sync)
+{
+    // While generating, the synchronizer stays set aside.
+    if (self->sync_input_ != nullptr)
+        self->sync_input_ = sync;
+    else
+        self->sync_ = sync;
+    // Keep heartbeats and scheduled deadlines on track through sync
+    // corrections.
+    if (sync != nullptr)
+        sync->set_clock_change_callback(&HarpCore::clock_changed);
+    clock_changed();
+    update_clock_capabilities();
+}
+
+void HarpCore::set_clock_generator(HarpClockGenerator* clock_gen)
+{
+    self->clock_gen_ = clock_gen;
+    // Packets follow our Harp time, which is the synchronizer's time when
+    // repeating.
+    if (clock_gen != nullptr)
+        clock_gen->set_time_source(system_to_harp_us_64,
+                                   harp_to_system_us_64);
+    update_clock_capabilities();
+}
+
+void HarpCore::set_scheduler(HarpScheduler* scheduler)
+{
+    self->scheduler_ = scheduler;
+    // The synchronizer's clock changes reach the scheduler through
+    // clock_changed().
+    if (scheduler != nullptr)
+        scheduler->set_time_source(system_to_harp_us_64,
+                                   harp_to_system_us_64);
+}
+
+bool HarpCore::take_due_heartbeat(uint32_t& heartbeat_s)
+{
+    heartbeat_s = self->next_heartbeat_s_;
+    if (harp_time_us_64() < uint64_t(heartbeat_s) * 1'000'000ULL)
+        return false;
+    self->next_heartbeat_s_ = heartbeat_s + self->heartbeat_interval_s_;
+    return true;
+}
+
+void HarpCore::arm_heartbeat()
+{
+    uint64_t harp_time_us = harp_time_us_64();
+    uint64_t heartbeat_us = uint64_t(self->next_heartbeat_s_) * 1'000'000ULL;
+    uint64_t interval_us = uint64_t(self->heartbeat_interval_s_)
+                           * 1'000'000ULL;
+    // Start over if Harp time stepped by more than an interval. Smaller
+    // corrections keep the heartbeat (and send it late rather than skip it).
+    if ((harp_time_us >= heartbeat_us + interval_us)
+        || (heartbeat_us > harp_time_us + interval_us))
+    {
+        self->next_heartbeat_s_ = uint32_t(hal_div_u64u64(harp_time_us,
+                                                          1'000'000ULL)) + 1;
+        heartbeat_us = uint64_t(self->next_heartbeat_s_) * 1'000'000ULL;
+    }
+    if (self->heartbeat_alarm_num_ < 0)
+        return;
+    uint64_t target_us = harp_to_system_us_64(heartbeat_us);
+    // If the heartbeat is already due, issue it as soon as possible instead.
+    while (!hal_alarm_set_target((unsigned int)self->heartbeat_alarm_num_,
+                                 target_us))
+        target_us = hal_time_us_64() + 1;
+}
+
+void HarpCore::restart_heartbeat()
+{
+    uint32_t interrupt_status = hal_save_and_disable_interrupts();
+    self->next_heartbeat_s_ = harp_time_s() + 1;
+    arm_heartbeat();
+    hal_restore_interrupts(interrupt_status);
+}
+
+void HarpCore::heartbeat_alarm_callback(unsigned int /*alarm_num*/)
+{
+    // Harp time may have been corrected since the alarm was set, so check
+    // that the heartbeat is really due.
+    uint32_t heartbeat_s;
+    if (take_due_heartbeat(heartbeat_s) && heartbeat_enabled())
+    {
+        // Leave it for run(), which timestamps the event at exactly the
+        // whole second it reports.
+        self->pending_heartbeat_s_ = heartbeat_s;
+        self->heartbeat_pending_ = true;
+    }
+    arm_heartbeat();
+}
+
+void HarpCore::clock_changed()
+{
+    uint32_t interrupt_status = hal_save_and_disable_interrupts();
+    arm_heartbeat();
+    hal_restore_interrupts(interrupt_status);
+    if (self->scheduler_ != nullptr)
+        self->scheduler_->remap();
+    if (self->clock_gen_ != nullptr)
+        HarpClockGenerator::remap();
 }
 
 void HarpCore::write_timestamp_offset(msg_t& msg)
 {
-    // TODO.
+    const uint8_t& offset_steps = *((uint8_t*)msg.payload);
+    self->timestamp_offset_us_ = offset_steps * TIMESTAMP_OFFSET_STEP_US;
     write_reg_generic(msg);
 }
 
+bool HarpCore::set_event_latency_us(uint8_t reg_name, uint32_t latency_us)
+{
+    event_latency_t* latencies = self->event_latencies_;
+    uint8_t& count = self->event_latency_count_;
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        if (latencies[i].reg_name != reg_name)
+            continue;
+        // Remove by moving the last entry into this one's place.
+        if (latency_us == 0)
+            latencies[i] = latencies[--count];
+        else
+            latencies[i].latency_us = latency_us;
+        return true;
+    }
+    if (latency_us == 0)
+        return true;
+    if (count == HARP_EVENT_LATENCY_SOURCES)
+        return false;
+    latencies[count++] = {reg_name, latency_us};
+    return true;
+}
+
+uint32_t HarpCore::event_latency_us(uint8_t reg_name)
+{
+    for (uint8_t i = 0; i < self->event_latency_count_; ++i)
+    {
+        if (self->event_latencies_[i].reg_name == reg_name)
+            return self->event_latencies_[i].latency_us;
+    }
+    return 0;
+}
+
+
+void HarpCore::write_time_probe(msg_t& msg)
+{
+    volatile TimeProbe& probe = self->regs.R_TIME_PROBE;
+    probe.rx_harp_time_us = msg.rx_harp_time_us;
+    if (self->is_muted())
+        return;
+    // Stamp the reply as late as possible and send it out right away rather
+    // than let it wait to be coalesced, which the PC would count as delay.
+    uint64_t tx_harp_time_us = harp_time_us_64();
+    probe.tx_harp_time_us = tx_harp_time_us;
+    send_harp_reply(WRITE, msg.header.address, (volatile uint8_t*)&probe,
+                    sizeof(probe), U64, tx_harp_time_us);
+    self->flush_tx();
+}
+
+void HarpCore::write_time_adjust(msg_t& msg)
+{
+    const int32_t& adjust_us = *((int32_t*)msg.payload);
+    // If synchronizer is attached, also update the synchronizer's time.
+    set_harp_time_us_64(harp_time_us_64() + int64_t(adjust_us));
+    write_reg_generic(msg);
+}
@@ -0,0 +1,105 @@
+#include <harp_hal.h>
+#include <hardware/pio.h>
+#include <hardware/pio_instructions.h>
+#include <hardware/dma.h>
+#include <hardware/structs/timer.h>
+
+// Sync edge capture.
+// A PIO state machine waits for the rx pin's falling edge and then pushes a
+// word into its rx FIFO. The FIFO's DREQ paces a one-shot DMA transfer that
+// copies the timer's raw lower word, so the timer is latched a few system
+// clock cycles after the edge regardless of interrupt latency.
+// The PIO only reads the pin, so the pin keeps its uart function.
+namespace
+{
+PIO capture_pio = nullptr;
+uint capture_sm;
+uint capture_program_offset;
+int capture_dma_chan = -1;
+bool capture_armed = false;
+volatile uint32_t capture_time_us_32;
+} // namespace
+
+bool hal_sync_capture_init(uint8_t rx_pin)
+{
+    // Hand-assembled so that we do not need pioasm.
+    static const uint16_t instructions[] =
+    {
+        pio_encode_wait_pin(true, 0),   // Wait for the line to be idle (high).
+        pio_encode_wait_pin(false, 0),  // Wait for the start edge.
+        pio_encode_push(false, true),   // Trigger the DMA transfer.
+        pio_encode_pull(false, true),   // Stall until restarted by arming.
+    };
+    static const pio_program_t program =
+    {
+        .instructions = instructions,
+        .length = sizeof(instructions) / sizeof(instructions[0]),
+        .origin = -1
+    };
+    // Claim a state machine and room for the program on either PIO.
+    PIO pios[] = {pio1, pio0};
+    for (PIO pio: pios)
+    {
+        int sm = pio_claim_unused_sm(pio, false);
+        if (sm < 0)
+            continue;
+        if (!pio_can_add_program(pio, &program))
+        {
+            pio_sm_unclaim(pio, uint(sm));
+            continue;
+        }
+        capture_pio = pio;
+        capture_sm = uint(sm);
+        break;
+    }
+    if (capture_pio == nullptr)
+        return false;
+    capture_dma_chan = dma_claim_unused_channel(false);
+    if (capture_dma_chan < 0)
+    {
+        pio_sm_unclaim(capture_pio, capture_sm);
+        capture_pio = nullptr;
+        return false;
+    }
+    capture_program_offset = pio_add_program(capture_pio, &program);
+    pio_sm_config sm_config = pio_get_default_sm_config();
+    sm_config_set_in_pins(&sm_config, rx_pin);
+    sm_config_set_wrap(&sm_config, capture_program_offset,
+                       capture_program_offset + program.length - 1);
+    // Leave the state machine disabled until armed.
+    pio_sm_init(capture_pio, capture_sm, capture_program_offset, &sm_config);
+    // Copy one word from the timer per push.
+    dma_channel_config dma_config =
+        dma_channel_get_default_config(uint(capture_dma_chan));
+    channel_config_set_transfer_data_size(&dma_config, DMA_SIZE_32);
+    channel_config_set_read_increment(&dma_config, false);
+    channel_config_set_write_increment(&dma_config, false);
+    channel_config_set_dreq(&dma_config,
+                            pio_get_dreq(capture_pio, capture_sm, false));
+    dma_channel_configure(uint(capture_dma_chan), &dma_config,
+                          &capture_time_us_32, &timer_hw->timerawl, 1, false);
+    return true;
+}
+
+void hal_sync_capture_arm()
+{
+    // Restart the state machine from the top with empty FIFOs.
+    pio_sm_set_enabled(capture_pio, capture_sm, false);
+    pio_sm_clear_fifos(capture_pio, capture_sm);
+    pio_sm_restart(capture_pio, capture_sm);
+    pio_sm_exec(capture_pio, capture_sm,
+                pio_encode_jmp(capture_program_offset));
+    // Restart the transfer before the state machine can push.
+    dma_channel_abort(uint(capture_dma_chan));
+    dma_channel_set_trans_count(uint(capture_dma_chan), 1, true);
+    pio_sm_set_enabled(capture_pio, capture_sm, true);
+    capture_armed = true;
+}
+
+bool hal_sync_capture_get(uint32_t* time_us_32)
+{
+    if (!capture_armed || dma_channel_is_busy(uint(capture_dma_chan)))
+        return false;
+    *time_us_32 = capture_time_us_32;
+    return true;
+}
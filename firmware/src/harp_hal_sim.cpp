@@ -0,0 +1,619 @@
+#include <harp_hal.h>
+#include <atomic>
+#include <chrono>
+#include <cstring> // for memcpy
+#include <deque>
+#include <iterator> // for std::prev
+#include <thread>
+#include <vector>
+
+struct sim_uart_inst
+{
+    std::deque<uint8_t> rx_fifo;
+    bool fifo_enabled;
+    void (*rx_callback)(void);
+    uint32_t tx_byte_duration_us;
+    uint64_t tx_idle_time_us; // when the last queued byte finishes sending.
+    std::deque<sim_uart_tx_byte_t> tx_bytes; // sent, but not yet read.
+};
+
+static sim_uart_inst sim_uarts[2] = {{{}, false, nullptr, 0, 0, {}},
+                                     {{}, false, nullptr, 0, 0, {}}};
+uart_inst_t* const sim_uart0 = &sim_uarts[0];
+uart_inst_t* const sim_uart1 = &sim_uarts[1];
+
+// Simulated chip state.
+namespace
+{
+/**
+ * \brief byte FIFO with an optional capacity. Bytes are stored contiguously
+ *  so that pushes and pops are single copies.
+ */
+class ByteFifo
+{
+public:
+    explicit ByteFifo(size_t capacity = SIZE_MAX)
+    :capacity_{capacity}, read_index_{0}
+    {}
+
+    size_t size() const
+    {return data_.size() - read_index_;}
+
+    size_t space() const
+    {return capacity_ - size();}
+
+    size_t push(const uint8_t* bytes, size_t num_bytes)
+    {
+        num_bytes = (num_bytes < space())? num_bytes: space();
+        data_.insert(data_.end(), bytes, bytes + num_bytes);
+        return num_bytes;
+    }
+
+    size_t pop(uint8_t* bytes, size_t num_bytes)
+    {
+        num_bytes = (num_bytes < size())? num_bytes: size();
+        memcpy(bytes, data_.data() + read_index_, num_bytes);
+        read_index_ += num_bytes;
+        if (read_index_ == data_.size())
+            clear();
+        return num_bytes;
+    }
+
+    void clear()
+    {
+        data_.clear();
+        read_index_ = 0;
+    }
+
+private:
+    std::vector<uint8_t> data_;
+    size_t capacity_;
+    size_t read_index_;
+};
+
+// Clock.
+#define SIM_ALARM_COUNT (4) // Like the RP2040's timer.
+struct sim_alarm_t
+{
+    bool claimed;
+    bool armed;
+    uint64_t target_us;
+    void (*callback)(unsigned int alarm_num);
+};
+sim_alarm_t alarms[SIM_ALARM_COUNT] = {};
+bool alarms_firing = false;
+std::atomic<bool> clock_manual{false};
+std::atomic<uint64_t> clock_manual_us{0};
+std::atomic<int64_t> clock_offset_us{0}; // added to the host clock.
+const auto clock_epoch = std::chrono::steady_clock::now();
+sim_cpu_costs_t cpu_costs{0, 0, 0};
+uint64_t cpu_pending_ns = 0; // charged, but less than 1[us].
+
+// Usb CDC transport.
+bool cdc_connected = true;
+ByteFifo cdc_rx_fifo(CFG_TUD_CDC_RX_BUFSIZE); // PC-to-device.
+ByteFifo cdc_tx_fifo(CFG_TUD_CDC_TX_BUFSIZE); // device-to-PC, not yet sent.
+ByteFifo cdc_pc_buffer; // device-to-PC, sent but not yet read.
+sim_cdc_stats_t cdc_stats{0, 0, 0, 0};
+struct sim_pc_write_t
+{
+    uint64_t time_us;
+    std::vector<uint8_t> bytes;
+    size_t bytes_sent;
+};
+std::deque<sim_pc_write_t> cdc_pc_writes; // PC-to-device, by arrival time.
+
+// Sync edge capture.
+bool capture_available = true;
+bool capture_armed = false;
+bool capture_latched = false;
+uint32_t capture_time_us_32 = 0;
+
+// Chip.
+bool reset_to_bootloader_requested = false;
+thread_local uint32_t core_num = 0;
+bool event_pending = false; // the event register that `__wfe()` waits on.
+sim_idle_stats_t idle_stats{0, 0, 0};
+
+int64_t host_clock_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - clock_epoch).count();
+}
+
+/**
+ * \brief advance the manual clock by \p ns of the device's work.
+ */
+void charge_cpu_ns(uint64_t ns)
+{
+    if (!clock_manual.load(std::memory_order_relaxed))
+        return;
+    cpu_pending_ns += ns;
+    if (cpu_pending_ns < 1000)
+        return;
+    uint64_t delta_us = cpu_pending_ns / 1000;
+    cpu_pending_ns %= 1000;
+    sim_clock_advance_us(delta_us);
+}
+
+// Send up to one usb packet from the tx FIFO to the PC.
+void cdc_send_packet()
+{
+    size_t packet_size = (cdc_tx_fifo.size() < USBD_CDC_IN_OUT_MAX_SIZE)?
+                             cdc_tx_fifo.size():
+                             USBD_CDC_IN_OUT_MAX_SIZE;
+    if (packet_size == 0)
+        return;
+    if (packet_size == USBD_CDC_IN_OUT_MAX_SIZE)
+        ++cdc_stats.full_packets;
+    else
+        ++cdc_stats.short_packets;
+    cdc_stats.bytes_to_pc += packet_size;
+    uint8_t packet[USBD_CDC_IN_OUT_MAX_SIZE];
+    cdc_tx_fifo.pop(packet, packet_size);
+    cdc_pc_buffer.push(packet, packet_size);
+}
+
+/**
+ * \brief the armed alarm with the earliest target, or nullptr if none.
+ */
+sim_alarm_t* next_alarm()
+{
+    sim_alarm_t* next = nullptr;
+    for (auto& alarm: alarms)
+    {
+        if (alarm.armed && ((next == nullptr)
+                            || (alarm.target_us < next->target_us)))
+            next = &alarm;
+    }
+    return next;
+}
+
+/**
+ * \brief deliver the front timed PC write into the rx FIFO, as much as fits.
+ * \return true if it was delivered completely (and removed).
+ */
+bool deliver_pc_write()
+{
+    sim_pc_write_t& write = cdc_pc_writes.front();
+    size_t bytes_written = cdc_rx_fifo.push(
+        write.bytes.data() + write.bytes_sent,
+        write.bytes.size() - write.bytes_sent);
+    write.bytes_sent += bytes_written;
+    cdc_stats.bytes_from_pc += bytes_written;
+    if (bytes_written > 0)
+        event_pending = true; // usb interrupt.
+    if (write.bytes_sent < write.bytes.size())
+        return false;
+    cdc_pc_writes.pop_front();
+    return true;
+}
+
+/**
+ * \brief call the alarms and deliver the timed PC writes that come due up to
+ *  \p time_us in order. In manual mode, the clock is moved to each one's
+ *  time before it happens and ends up at \p time_us.
+ */
+void fire_alarms_until(uint64_t time_us)
+{
+    // An alarm callback that moves the clock must not fire alarms itself.
+    if (alarms_firing)
+        return;
+    alarms_firing = true;
+    bool rx_fifo_full = false;
+    while (true)
+    {
+        sim_alarm_t* alarm = next_alarm();
+        bool alarm_due = (alarm != nullptr) && (alarm->target_us <= time_us);
+        bool write_due = !rx_fifo_full && !cdc_pc_writes.empty()
+                         && (cdc_pc_writes.front().time_us <= time_us);
+        if (!alarm_due && !write_due)
+            break;
+        if (write_due && (!alarm_due
+                          || (cdc_pc_writes.front().time_us
+                              <= alarm->target_us)))
+        {
+            uint64_t write_time_us = cdc_pc_writes.front().time_us;
+            if (clock_manual.load(std::memory_order_relaxed)
+                && (write_time_us > clock_manual_us.load()))
+                clock_manual_us.store(write_time_us);
+            rx_fifo_full = !deliver_pc_write();
+            continue;
+        }
+        if (clock_manual.load(std::memory_order_relaxed)
+            && (alarm->target_us > clock_manual_us.load()))
+            clock_manual_us.store(alarm->target_us);
+        alarm->armed = false;
+        alarm->callback((unsigned int)(alarm - alarms));
+        event_pending = true; // returning from the alarm interrupt.
+    }
+    alarms_firing = false;
+}
+
+void cdc_task()
+{
+    fire_alarms_until(hal_time_us_64());
+    // Full packets are sent as soon as they are available.
+    while (cdc_tx_fifo.size() >= USBD_CDC_IN_OUT_MAX_SIZE)
+        cdc_send_packet();
+}
+} // namespace
+
+// Clock.
+uint64_t hal_time_us_64()
+{
+    if (clock_manual.load(std::memory_order_relaxed))
+        return clock_manual_us.load(std::memory_order_relaxed);
+    return uint64_t(host_clock_us()
+                    + clock_offset_us.load(std::memory_order_relaxed));
+}
+
+uint32_t hal_time_us_32()
+{return uint32_t(hal_time_us_64());}
+
+int hal_alarm_claim(void (*callback)(unsigned int alarm_num))
+{
+    for (int i = 0; i < SIM_ALARM_COUNT; ++i)
+    {
+        if (alarms[i].claimed)
+            continue;
+        alarms[i] = {true, false, 0, callback};
+        return i;
+    }
+    return -1;
+}
+
+bool hal_alarm_set_target(unsigned int alarm_num, uint64_t system_time_us)
+{
+    sim_alarm_t& alarm = alarms[alarm_num];
+    alarm.armed = (system_time_us > hal_time_us_64());
+    alarm.target_us = system_time_us;
+    return alarm.armed;
+}
+
+void hal_alarm_cancel(unsigned int alarm_num)
+{alarms[alarm_num].armed = false;}
+
+// Division.
+uint32_t hal_divmod_u32u32_rem(uint32_t a, uint32_t b, uint32_t* rem)
+{
+    *rem = a % b;
+    return a / b;
+}
+
+uint64_t hal_divmod_u64u64_rem(uint64_t a, uint64_t b, uint64_t* rem)
+{
+    *rem = a % b;
+    return a / b;
+}
+
+uint64_t hal_div_u64u64(uint64_t a, uint64_t b)
+{return a / b;}
+
+// Usb CDC transport.
+void hal_cdc_init(){}
+
+void hal_cdc_task()
+{
+    charge_cpu_ns(cpu_costs.run_ns);
+    cdc_task();
+}
+
+bool hal_cdc_connected()
+{return cdc_connected;}
+
+uint32_t hal_cdc_available()
+{return uint32_t(cdc_rx_fifo.size());}
+
+uint32_t hal_cdc_read(void* buffer, uint32_t num_bytes)
+{
+    uint32_t bytes_read = uint32_t(cdc_rx_fifo.pop((uint8_t*)buffer,
+                                                   num_bytes));
+    charge_cpu_ns(uint64_t(bytes_read) * cpu_costs.byte_ns);
+    return bytes_read;
+}
+
+uint32_t hal_cdc_write_available()
+{return uint32_t(cdc_tx_fifo.space());}
+
+uint32_t hal_cdc_write(const void* buffer, uint32_t num_bytes)
+{
+    uint32_t bytes_written = cdc_tx_fifo.push((const uint8_t*)buffer,
+                                              num_bytes);
+    charge_cpu_ns(uint64_t(bytes_written) * cpu_costs.byte_ns);
+    cdc_task();
+    return bytes_written;
+}
+
+void hal_cdc_write_flush()
+{
+    while (cdc_tx_fifo.size() > 0)
+        cdc_send_packet();
+}
+
+// Sync uart.
+void hal_sync_uart_init(uart_inst_t* uart, uint8_t /*rx_pin*/,
+                        uint32_t /*baudrate*/, uint8_t /*data_bits*/,
+                        uint8_t /*stop_bits*/, uart_parity_t /*parity*/,
+                        bool fifo_enabled, void (*rx_callback)(void))
+{
+    uart->rx_fifo.clear();
+    uart->fifo_enabled = fifo_enabled;
+    uart->rx_callback = rx_callback;
+}
+
+bool hal_sync_uart_is_readable(uart_inst_t* uart)
+{return !uart->rx_fifo.empty();}
+
+uint8_t hal_sync_uart_getc(uart_inst_t* uart)
+{
+    uint8_t byte = uart->rx_fifo.front();
+    uart->rx_fifo.pop_front();
+    return byte;
+}
+
+void hal_sync_uart_tx_init(uart_inst_t* uart, uint8_t /*tx_pin*/,
+                           uint32_t baudrate, uint8_t data_bits,
+                           uint8_t stop_bits, uart_parity_t parity)
+{
+    uint32_t bits_per_byte = 1 + data_bits + stop_bits
+                             + ((parity == UART_PARITY_NONE)? 0: 1);
+    uart->tx_byte_duration_us = bits_per_byte * 1'000'000UL / baudrate;
+    uart->tx_idle_time_us = 0;
+    uart->tx_bytes.clear();
+}
+
+void hal_sync_uart_write(uart_inst_t* uart, const uint8_t* data,
+                         size_t num_bytes)
+{
+    // Bytes go out back-to-back, starting right away if the line is idle.
+    uint64_t curr_time_us = hal_time_us_64();
+    for (size_t i = 0; i < num_bytes; ++i)
+    {
+        uint64_t start_us = (uart->tx_idle_time_us > curr_time_us)?
+                                uart->tx_idle_time_us: curr_time_us;
+        uart->tx_bytes.push_back({start_us, data[i]});
+        uart->tx_idle_time_us = start_us + uart->tx_byte_duration_us;
+    }
+}
+
+// Sync edge capture.
+bool hal_sync_capture_init(uint8_t /*rx_pin*/)
+{return capture_available;}
+
+void hal_sync_capture_arm()
+{
+    capture_armed = true;
+    capture_latched = false;
+}
+
+bool hal_sync_capture_get(uint32_t* time_us_32)
+{
+    if (!capture_latched)
+        return false;
+    *time_us_32 = capture_time_us_32;
+    return true;
+}
+
+// Chip.
+void hal_get_unique_board_id(uint8_t id[HAL_UNIQUE_ID_SIZE])
+{
+    for (uint8_t i = 0; i < HAL_UNIQUE_ID_SIZE; ++i)
+        id[i] = i;
+}
+
+void hal_reset_to_bootloader()
+{reset_to_bootloader_requested = true;}
+
+void hal_launch_core1(void (*entry)(void))
+{
+    // Core1 runs forever, so the thread is never joined.
+    std::thread([entry]()
+    {
+        core_num = 1;
+        entry();
+    }).detach();
+}
+
+uint32_t hal_get_core_num()
+{return core_num;}
+
+void hal_tight_loop_contents()
+{std::this_thread::yield();}
+
+// Simulated interrupts run inline on the thread that triggers them, so there
+// is nothing to disable.
+uint32_t hal_save_and_disable_interrupts()
+{return 0;}
+
+void hal_restore_interrupts(uint32_t /*status*/){}
+
+// Low-power waiting.
+void hal_wait_for_event_until(uint64_t system_time_us)
+{
+    ++idle_stats.waits;
+    uint64_t start_time_us = hal_time_us_64();
+    if (!event_pending && clock_manual.load(std::memory_order_relaxed))
+    {
+        // Sleep until the next interrupt or the timeout.
+        uint64_t wake_time_us = system_time_us;
+        sim_alarm_t* alarm = next_alarm();
+        if ((alarm != nullptr) && (alarm->target_us < wake_time_us))
+            wake_time_us = alarm->target_us;
+        if (!cdc_pc_writes.empty()
+            && (cdc_pc_writes.front().time_us < wake_time_us))
+            wake_time_us = cdc_pc_writes.front().time_us;
+        if (wake_time_us > start_time_us)
+        {
+            ++idle_stats.sleeps;
+            sim_clock_set_us(wake_time_us + cpu_costs.wake_us);
+            idle_stats.idle_us += wake_time_us - start_time_us;
+        }
+    }
+    event_pending = false;
+}
+
+void hal_send_event()
+{event_pending = true;}
+
+// Simulation controls.
+void sim_reset()
+{
+    clock_manual.store(false);
+    clock_manual_us.store(0);
+    clock_offset_us.store(-host_clock_us());
+    cdc_connected = true;
+    cdc_rx_fifo.clear();
+    cdc_tx_fifo.clear();
+    cdc_pc_buffer.clear();
+    cdc_stats = {0, 0, 0, 0};
+    cdc_pc_writes.clear();
+    for (auto& uart: sim_uarts)
+    {
+        uart.rx_fifo.clear();
+        uart.tx_idle_time_us = 0;
+        uart.tx_bytes.clear();
+    }
+    for (auto& alarm: alarms)
+        alarm.armed = false;
+    capture_armed = false;
+    capture_latched = false;
+    reset_to_bootloader_requested = false;
+    event_pending = false;
+    idle_stats = {0, 0, 0};
+    cpu_costs = {0, 0, 0};
+    cpu_pending_ns = 0;
+}
+
+void sim_clock_set_manual(bool manual)
+{
+    if (manual)
+        clock_manual_us.store(hal_time_us_64());
+    else // Resume from the current time.
+        clock_offset_us.store(int64_t(clock_manual_us.load())
+                              - host_clock_us());
+    clock_manual.store(manual);
+}
+
+void sim_clock_set_us(uint64_t time_us)
+{
+    fire_alarms_until(time_us);
+    clock_manual_us.store(time_us);
+    clock_offset_us.store(int64_t(time_us) - host_clock_us());
+}
+
+void sim_clock_advance_us(uint64_t delta_us)
+{sim_clock_set_us(hal_time_us_64() + delta_us);}
+
+void sim_cpu_set_costs(const sim_cpu_costs_t& costs)
+{cpu_costs = costs;}
+
+void sim_cdc_set_connected(bool connected)
+{cdc_connected = connected;}
+
+size_t sim_cdc_pc_write(const void* data, size_t num_bytes)
+{
+    size_t bytes_written = cdc_rx_fifo.push((const uint8_t*)data, num_bytes);
+    cdc_stats.bytes_from_pc += bytes_written;
+    if (bytes_written > 0)
+        event_pending = true; // usb interrupt.
+    return bytes_written;
+}
+
+void sim_cdc_pc_write_at(uint64_t time_us, const void* data,
+                         size_t num_bytes)
+{
+    // Keep writes in arrival order. Writes at the same time stay in the order
+    // they were made.
+    auto position = cdc_pc_writes.end();
+    while ((position != cdc_pc_writes.begin())
+           && (std::prev(position)->time_us > time_us))
+        --position;
+    const uint8_t* bytes = (const uint8_t*)data;
+    cdc_pc_writes.insert(position, {time_us, std::vector<uint8_t>(
+                                        bytes, bytes + num_bytes), 0});
+    // Deliver it now if it is already due.
+    fire_alarms_until(hal_time_us_64());
+}
+
+size_t sim_cdc_pc_read(void* data, size_t max_bytes)
+{return cdc_pc_buffer.pop((uint8_t*)data, max_bytes);}
+
+size_t sim_cdc_pc_available()
+{return cdc_pc_buffer.size();}
+
+void sim_cdc_pc_discard()
+{cdc_pc_buffer.clear();}
+
+sim_cdc_stats_t sim_cdc_stats()
+{return cdc_stats;}
+
+void sim_sync_uart_receive(uart_inst_t* uart, const uint8_t* data,
+                           size_t num_bytes)
+{
+    // Every byte starts with a falling edge.
+    if (num_bytes > 0)
+        sim_sync_line_edge();
+    uart->rx_fifo.insert(uart->rx_fifo.end(), data, data + num_bytes);
+}
+
+void sim_sync_uart_interrupt(uart_inst_t* uart)
+{
+    if (uart->rx_callback == nullptr)
+        return;
+    event_pending = true; // returning from the uart interrupt.
+    // Stop if a call reads nothing so that a callback that never reads cannot
+    // hang the simulation.
+    size_t unread_bytes;
+    do
+    {
+        unread_bytes = uart->rx_fifo.size();
+        uart->rx_callback();
+    } while (!uart->rx_fifo.empty() && (uart->rx_fifo.size() < unread_bytes));
+}
+
+void sim_sync_line_edge()
+{
+    if (!capture_armed)
+        return;
+    capture_time_us_32 = hal_time_us_32();
+    capture_latched = true;
+    capture_armed = false;
+}
+
+void sim_sync_uart_write(uart_inst_t* uart, const uint8_t* data,
+                         size_t num_bytes)
+{
+    if (uart->fifo_enabled)
+    {
+        sim_sync_uart_receive(uart, data, num_bytes);
+        sim_sync_uart_interrupt(uart);
+        return;
+    }
+    for (size_t i = 0; i < num_bytes; ++i)
+    {
+        sim_sync_uart_receive(uart, &data[i], 1);
+        sim_sync_uart_interrupt(uart);
+    }
+}
+
+void sim_sync_capture_set_available(bool available)
+{capture_available = available;}
+
+size_t sim_sync_uart_tx_read(uart_inst_t* uart, sim_uart_tx_byte_t* bytes,
+                             size_t max_bytes)
+{
+    size_t num_bytes = 0;
+    for (; (num_bytes < max_bytes) && !uart->tx_bytes.empty(); ++num_bytes)
+    {
+        bytes[num_bytes] = uart->tx_bytes.front();
+        uart->tx_bytes.pop_front();
+    }
+    return num_bytes;
+}
+
+bool sim_reset_to_bootloader_requested()
+{return reset_to_bootloader_requested;}
+
+sim_idle_stats_t sim_idle_stats()
+{return idle_stats;}
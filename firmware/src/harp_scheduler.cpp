@@ -0,0 +1,187 @@
+#include <harp_scheduler.h>
+#include <harp_core.h>
+
+HarpScheduler::HarpScheduler()
+:alarm_num_{-1}, system_to_harp_us_64_{nullptr},
+ harp_to_system_us_64_{nullptr}, count_{0}, next_sequence_{0},
+ late_actions_{0}
+{
+    // Create a pointer to the first (and one-and-only) instance created.
+    if (self == nullptr)
+        self = this;
+    alarm_num_ = hal_alarm_claim(alarm_callback);
+}
+
+HarpScheduler::~HarpScheduler(){self = nullptr;}
+
+HarpScheduler& HarpScheduler::init()
+{
+    static HarpScheduler scheduler;
+    return scheduler;
+}
+
+bool HarpScheduler::call_at(uint64_t harp_time_us,
+                            void (*callback)(void* context), void* context)
+{
+    action_t action;
+    action.harp_time_us = harp_time_us;
+    action.type = CALL;
+    action.callback = callback;
+    action.target = context;
+    return schedule(action);
+}
+
+bool HarpScheduler::write_at(uint64_t harp_time_us, volatile void* dest,
+                             const void* data, uint8_t num_bytes)
+{
+    if (num_bytes > HARP_SCHEDULER_MAX_PAYLOAD_SIZE)
+        return false;
+    action_t action;
+    action.harp_time_us = harp_time_us;
+    action.type = WRITE_REG;
+    action.num_bytes = num_bytes;
+    memcpy(action.payload, data, num_bytes);
+    action.target = dest;
+    return schedule(action);
+}
+
+bool HarpScheduler::event_at(uint64_t harp_time_us, uint8_t reg_name)
+{
+    action_t action;
+    action.harp_time_us = harp_time_us;
+    action.type = POST_EVENT;
+    action.reg_name = reg_name;
+    return schedule(action);
+}
+
+void HarpScheduler::cancel_all()
+{
+    uint32_t interrupt_status = hal_save_and_disable_interrupts();
+    self->count_ = 0;
+    if (self->alarm_num_ >= 0)
+        hal_alarm_cancel((unsigned int)self->alarm_num_);
+    hal_restore_interrupts(interrupt_status);
+}
+
+void HarpScheduler::remap()
+{
+    if ((self == nullptr) || (self->harp_to_system_us_64_ == nullptr))
+        return;
+    uint32_t interrupt_status = hal_save_and_disable_interrupts();
+    self->arm();
+    hal_restore_interrupts(interrupt_status);
+}
+
+bool HarpScheduler::schedule(action_t& action)
+{
+    if (!is_available() || (self->harp_to_system_us_64_ == nullptr))
+        return false;
+    uint32_t interrupt_status = hal_save_and_disable_interrupts();
+    if (self->count_ == HARP_SCHEDULER_SIZE)
+    {
+        hal_restore_interrupts(interrupt_status);
+        return false;
+    }
+    action.sequence = self->next_sequence_++;
+    uint8_t index = self->count_;
+    self->actions_[index] = action;
+    self->count_ = index + 1;
+    self->sift_up(index);
+    // Only a new earliest action moves the alarm.
+    if (self->actions_[0].sequence == action.sequence)
+        self->arm();
+    hal_restore_interrupts(interrupt_status);
+    return true;
+}
+
+void HarpScheduler::alarm_callback(unsigned int /*alarm_num*/)
+{
+    // Run every action that is due. Actions may schedule more actions, so
+    // pop each one before running it.
+    while (self->count_ > 0)
+    {
+        uint64_t harp_time_us = self->system_to_harp_us_64_(hal_time_us_64());
+        uint32_t interrupt_status = hal_save_and_disable_interrupts();
+        // Harp time may have been corrected since the alarm was set.
+        if (self->actions_[0].harp_time_us > harp_time_us)
+        {
+            self->arm();
+            hal_restore_interrupts(interrupt_status);
+            return;
+        }
+        action_t action = self->actions_[0];
+        uint8_t count = self->count_ - 1;
+        self->count_ = count;
+        self->actions_[0] = self->actions_[count];
+        self->sift_down(0);
+        hal_restore_interrupts(interrupt_status);
+        if (harp_time_us - action.harp_time_us > HARP_SCHEDULER_MAX_LATE_US)
+            self->late_actions_ = self->late_actions_ + 1;
+        run_action(action);
+    }
+}
+
+void HarpScheduler::run_action(const action_t& action)
+{
+    switch (action.type)
+    {
+        case CALL:
+            action.callback((void*)action.target);
+            break;
+        case WRITE_REG:
+            for (uint8_t i = 0; i < action.num_bytes; ++i)
+                ((volatile uint8_t*)action.target)[i] = action.payload[i];
+            break;
+        case POST_EVENT:
+            HarpCore::post_event_from_isr(self->events_, action.reg_name,
+                                          action.harp_time_us);
+            break;
+    }
+}
+
+void HarpScheduler::arm()
+{
+    if (count_ == 0)
+    {
+        hal_alarm_cancel((unsigned int)alarm_num_);
+        return;
+    }
+    uint64_t target_us = harp_to_system_us_64_(actions_[0].harp_time_us);
+    // If the deadline has already passed, fire as soon as possible instead.
+    while (!hal_alarm_set_target((unsigned int)alarm_num_, target_us))
+        target_us = hal_time_us_64() + 1;
+}
+
+void HarpScheduler::sift_up(uint8_t index)
+{
+    while (index > 0)
+    {
+        uint8_t parent = (index - 1) / 2;
+        if (!precedes(actions_[index], actions_[parent]))
+            return;
+        action_t tmp = actions_[parent];
+        actions_[parent] = actions_[index];
+        actions_[index] = tmp;
+        index = parent;
+    }
+}
+
+void HarpScheduler::sift_down(uint8_t index)
+{
+    while (true)
+    {
+        uint8_t earliest = index;
+        uint8_t left = 2 * index + 1;
+        uint8_t right = left + 1;
+        if ((left < count_) && precedes(actions_[left], actions_[earliest]))
+            earliest = left;
+        if ((right < count_) && precedes(actions_[right], actions_[earliest]))
+            earliest = right;
+        if (earliest == index)
+            return;
+        action_t tmp = actions_[earliest];
+        actions_[earliest] = actions_[index];
+        actions_[index] = tmp;
+        index = earliest;
+    }
+}
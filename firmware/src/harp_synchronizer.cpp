@@ -1,32 +1,66 @@
 #include <harp_synchronizer.h>
 
+static_assert((HARP_SYNC_FILTER_SIZE % 2) == 1,
+              "The sync filter needs an odd size to have a median.");
+
+// Max rate correction in parts-per-2^32.
+static constexpr int32_t max_rate_q32 =
+    int32_t((int64_t(HARP_SYNC_MAX_RATE_PPM) << 32) / 1'000'000);
+
+/**
+ * \brief limit a rate correction to +/-`HARP_SYNC_MAX_RATE_PPM`.
+ */
+static inline int32_t clamp_rate_q32(int64_t rate_q32)
+{
+    if (rate_q32 > max_rate_q32)
+        return max_rate_q32;
+    if (rate_q32 < -max_rate_q32)
+        return -max_rate_q32;
+    return int32_t(rate_q32);
+}
+
+/**
+ * \brief express a phase error accumulated over an interval as a rate in
+ *  parts-per-2^32, limited to +/-`HARP_SYNC_MAX_RATE_PPM`.
+ */
+static int32_t phase_error_to_rate_q32(int64_t phase_error_us,
+                                       uint64_t interval_us)
+{
+    // Divide magnitudes since the HAL only provides unsigned division.
+    uint64_t magnitude = uint64_t((phase_error_us < 0)? -phase_error_us:
+                                                        phase_error_us);
+    uint64_t rate_q32 = hal_div_u64u64(magnitude << 32, interval_us);
+    if (rate_q32 > uint64_t(max_rate_q32))
+        rate_q32 = max_rate_q32;
+    return (phase_error_us < 0)? -int32_t(rate_q32): int32_t(rate_q32);
+}
+
 
 HarpSynchronizer::HarpSynchronizer(uart_inst_t* uart_id, uint8_t uart_rx_pin)
-:uart_id_{uart_id}, packet_index_{0}, sync_data_{0, 0, 0, 0},
- state_{RECEIVE_HEADER_0}, new_timestamp_{false}, offset_us_64_{0},
- has_synced_{false}
+:uart_id_{uart_id}, decoder_{}, edge_capture_{false}, has_synced_{false},
+ locked_{false}, sync_timeout_us_{HARP_SYNC_TIMEOUT_US},
+ last_residual_ns_{0}, mean_residual_ns_{0}, jitter_ns_{0},
+ packets_received_{0}, packets_rejected_{0}, lock_losses_{0},
+ residuals_us_{0}, residual_index_{0}, residual_count_{0},
+ consecutive_rejections_{0},
+ outlier_bound_us_{HARP_SYNC_OUTLIER_BOUND_US}, step_pending_{false},
+ pending_step_us_{0},
+ models_{{0, 0, 0}, {0, 0, 0}}, model_version_{0}, drift_q32_{0},
+ last_sync_system_us_{0}, last_packet_system_us_{0}, coasting_{false},
+ clock_change_callback_{nullptr}
 {
     // Create a pointer to the first (and one-and-only) instance created.
     if (self == nullptr)
         self = this;
-    // Setup uart.
-    uart_init(uart_id_, HARP_SYNC_BAUDRATE);
-    // Disable hardware flow control.
-    uart_set_hw_flow(uart_id_, false, false);
-    // Set data format
-    uart_set_format(uart_id_, HARP_SYNC_DATA_BITS, HARP_SYNC_STOP_BITS,
-                    HARP_SYNC_PARITY);
-    // Setup the RX pin by using the function select on the GPIO
-    gpio_set_function(uart_rx_pin, GPIO_FUNC_UART);
-    // Turn off internal FIFO. (FIFO set to size 1.)
-    uart_set_fifo_enabled(uart_id, false);
-    // Select correct interrupt handler for the UART we are using.
-    int uart_irq = (uart_id == uart0) ? UART0_IRQ : UART1_IRQ;
-    // Attach the static callback function.
-    irq_set_exclusive_handler(uart_irq, uart_rx_callback);
-    irq_set_enabled(uart_irq, true);
-    // Enable RX-based interrupts.
-    uart_set_irq_enables(uart_id_, true, false);
+    // Latch the timer on each packet's start edge if the hardware allows it.
+    edge_capture_ = hal_sync_capture_init(uart_rx_pin);
+    // Setup uart and attach the static callback function to its rx interrupt.
+    // With edge capture, we only need one interrupt per packet.
+    hal_sync_uart_init(uart_id_, uart_rx_pin, HARP_SYNC_BAUDRATE,
+                       HARP_SYNC_DATA_BITS, HARP_SYNC_STOP_BITS,
+                       HARP_SYNC_PARITY, edge_capture_, uart_rx_callback);
+    if (edge_capture_)
+        hal_sync_capture_arm();
 }
 
 HarpSynchronizer::~HarpSynchronizer(){self = nullptr;}
@@ -40,61 +74,220 @@ HarpSynchronizer& HarpSynchronizer::init(uart_inst_t* uart_id,
 
 void HarpSynchronizer::uart_rx_callback()
 {
-    // Hush interrupts, since we make assumptions about how long this fn takes.
-    //uint32_t interrupt_status = save_and_disable_interrupts();
-    SyncState next_state_{self->state_}; // Init next state at curr state value.
-    uint8_t new_byte;
-    // This State machine "ticks" every time we receive at least one new byte.
-    // Handle next-state/output logic.
-    while (uart_is_readable(self->uart_id_) and not self->new_timestamp_)
+    // Drain the uart. With edge capture, this runs once per packet (after the
+    // uart's rx timeout). Otherwise, it runs once per byte.
+    bool new_packet = false;
+    while (hal_sync_uart_is_readable(self->uart_id_) && !new_packet)
+        new_packet = self->decoder_.push(hal_sync_uart_getc(self->uart_id_));
+    if (!new_packet)
     {
-        new_byte = uart_getc(self->uart_id_);
-        #ifdef DEBUG
-        //printf("state: %d | byte: 0x%x\r\n", self->state_, new_byte);
-        #endif
-        switch (self->state_)
+        if (self->edge_capture_)
         {
-            case RECEIVE_HEADER_0:
-                if (new_byte == 0xAA)
-                    next_state_ = RECEIVE_HEADER_1;
-                break;
-            case RECEIVE_HEADER_1:
-                if (new_byte == 0xAF)
-                    next_state_ = RECEIVE_TIMESTAMP;
-                else
-                    next_state_ = RECEIVE_HEADER_0;
-                break;
-            case RECEIVE_TIMESTAMP:
-                self->sync_data_[self->packet_index_++] = new_byte;
-                if (self->packet_index_ == 4)
-                {
-                    next_state_ = RECEIVE_HEADER_0;
-                    self->packet_index_ = 0;
-                    self->new_timestamp_ = true;
-                }
-                else
-                    next_state_ = RECEIVE_TIMESTAMP;
-                break;
+            // The rx timeout means the line has gone idle, so a partial
+            // packet lost bytes. Start over so that the next packet's header
+            // is not decoded as this packet's timestamp.
+            self->decoder_.reset();
+            // Discard any edge latched by bytes that were not a packet.
+            hal_sync_capture_arm();
+            // A damaged packet still shows that the link is alive.
+            self->last_packet_system_us_ = hal_time_us_64();
         }
-        self->state_ = next_state_;
+        return;
+    }
+    uint64_t curr_system_us = hal_time_us_64();
+    uint32_t encoded_seconds = self->decoder_.encoded_seconds();
+    ++self->packets_received_;
+    if (!self->edge_capture_)
+    {
+        self->discipline_clock(curr_system_us,
+                               sync_frame_end_harp_us(encoded_seconds));
+        return;
     }
-    if (not self->new_timestamp_)
+    uint32_t edge_time_us_32;
+    bool edge_latched = hal_sync_capture_get(&edge_time_us_32);
+    hal_sync_capture_arm(); // for the next packet.
+    uint64_t edge_time_us = extend_time_us_32(edge_time_us_32, curr_system_us);
+    // Without the packet's start edge, we cannot timestamp it accurately.
+    if (!edge_latched
+        || (curr_system_us - edge_time_us > HARP_SYNC_MAX_EDGE_AGE_US))
     {
-        //restore_interrupts(interrupt_status);
+        ++self->packets_rejected_;
+        self->last_packet_system_us_ = curr_system_us; // still a live link.
         return;
     }
-    // Apply new timestamp data.
-    // Interpret 4-byte sequence as a little-endian uint32_t.
-    // Add 1[s] per protocol spec since 4-byte sequence encodes previous second.
-    uint32_t sec = *((uint32_t*)(self->sync_data_)) + 1;
-    uint64_t curr_harp_us = uint64_t(sec) * 1'000'000 - HARP_SYNC_OFFSET_US;
-    self->offset_us_64_ = ::time_us_64() - curr_harp_us;
-    self->has_synced_ = true;
-    self->new_timestamp_ = false;
-    #ifdef DEBUG
-    //printf("harp time: %llu [us] | offset: %lld\r\n", curr_harp_us, self->offset_us_64_);
-    #endif
-    // Cleanup.
-    //restore_interrupts(interrupt_status);
+    self->discipline_clock(edge_time_us,
+                           sync_frame_start_harp_us(encoded_seconds));
 }
 
+void HarpSynchronizer::discipline_clock(uint64_t system_time_us,
+                                        uint64_t harp_time_us)
+{
+    ClockModel model = clock_model();
+    uint64_t local_harp_time_us = system_to_harp_us_64(system_time_us, model);
+    int64_t phase_error_us = int64_t(harp_time_us - local_harp_time_us);
+    // Saturate the residual since the first step can be arbitrarily big.
+    int32_t residual_us = (phase_error_us > INT32_MAX / 1000)? INT32_MAX / 1000:
+                          (phase_error_us < INT32_MIN / 1000)? INT32_MIN / 1000:
+                          int32_t(phase_error_us);
+    last_residual_ns_ = residual_us * 1000;
+    // Rejected packets still show that the external clock is connected.
+    last_packet_system_us_ = system_time_us;
+    // Reject packets delayed (or advanced) by interrupt latency.
+    if (has_synced_ && is_outlier(residual_us))
+    {
+        ++packets_rejected_;
+        return;
+    }
+    bool step = (phase_error_us > HARP_SYNC_STEP_THRESHOLD_US)
+                || (phase_error_us < -HARP_SYNC_STEP_THRESHOLD_US);
+    // Once synced, only step if the next packet agrees on the step. The
+    // outlier filter is still empty after a step or holdover, and a bit
+    // flipped in the timestamp would throw Harp time off by seconds.
+    if (has_synced_ && step)
+    {
+        int64_t step_change_us = phase_error_us - pending_step_us_;
+        bool confirmed = step_pending_
+                         && (step_change_us <= HARP_SYNC_STEP_THRESHOLD_US)
+                         && (step_change_us >= -HARP_SYNC_STEP_THRESHOLD_US);
+        step_pending_ = !confirmed;
+        pending_step_us_ = phase_error_us;
+        if (!confirmed)
+        {
+            ++packets_rejected_;
+            return;
+        }
+    }
+    else
+        step_pending_ = false;
+    uint64_t interval_us = system_time_us - last_sync_system_us_;
+    last_sync_system_us_ = system_time_us;
+    locked_ = true;
+    coasting_ = false;
+    // Step to the external time if we are too far off to slew.
+    if (!has_synced_ || (interval_us == 0) || step)
+    {
+        set_clock_model({system_time_us, harp_time_us, drift_q32_});
+        has_synced_ = true;
+        // Residuals measured against the old model no longer apply.
+        residual_count_ = 0;
+        return;
+    }
+    // Update running residual statistics (exponential moving averages).
+    int32_t residual_ns = residual_us * 1000;
+    mean_residual_ns_ += (residual_ns - mean_residual_ns_)
+                         >> HARP_SYNC_STATS_SHIFT;
+    int32_t deviation_ns = residual_ns - mean_residual_ns_;
+    deviation_ns = (deviation_ns < 0)? -deviation_ns: deviation_ns;
+    jitter_ns_ += (deviation_ns - jitter_ns_) >> HARP_SYNC_STATS_SHIFT;
+    // PI servo. The integral term tracks the crystal drift. The proportional
+    // term slews out part of the remaining phase error over the next period.
+    int32_t error_rate_q32 = phase_error_to_rate_q32(phase_error_us,
+                                                     interval_us);
+    int32_t drift_q32 = clamp_rate_q32(int64_t(drift_q32_)
+                                       + (error_rate_q32
+                                          >> HARP_SYNC_SERVO_KI_SHIFT));
+    drift_q32_ = drift_q32;
+    int32_t rate_q32 = clamp_rate_q32(int64_t(drift_q32)
+                                      + (error_rate_q32
+                                         >> HARP_SYNC_SERVO_KP_SHIFT));
+    // Start the new rate from the current Harp time so that it is continuous.
+    set_clock_model({system_time_us, local_harp_time_us, rate_q32});
+}
+
+bool HarpSynchronizer::is_outlier(int32_t residual_us)
+{
+    // Hampel filter: compare each residual to the median of the most recent
+    // accepted residuals.
+    bool outlier = false;
+    if ((outlier_bound_us_ != 0) && (residual_count_ == HARP_SYNC_FILTER_SIZE))
+    {
+        // Insertion sort a copy. The window is tiny.
+        int32_t sorted[HARP_SYNC_FILTER_SIZE];
+        for (uint8_t i = 0; i < HARP_SYNC_FILTER_SIZE; ++i)
+        {
+            uint8_t j = i;
+            for (; (j > 0) && (sorted[j - 1] > residuals_us_[i]); --j)
+                sorted[j] = sorted[j - 1];
+            sorted[j] = residuals_us_[i];
+        }
+        int32_t deviation_us = residual_us - sorted[HARP_SYNC_FILTER_SIZE / 2];
+        deviation_us = (deviation_us < 0)? -deviation_us: deviation_us;
+        // Rejected packets do not correct the clock, so the residuals of a
+        // clock that is still converging (or a real shift in the external
+        // time) keep growing. Accept those after a few rejections in a row.
+        outlier = (uint32_t(deviation_us) > outlier_bound_us_)
+                  && (consecutive_rejections_ < HARP_SYNC_FILTER_SIZE / 2);
+    }
+    if (outlier)
+    {
+        ++consecutive_rejections_;
+        return true;
+    }
+    consecutive_rejections_ = 0;
+    residuals_us_[residual_index_] = residual_us;
+    residual_index_ = (residual_index_ + 1) % HARP_SYNC_FILTER_SIZE;
+    if (residual_count_ < HARP_SYNC_FILTER_SIZE)
+        ++residual_count_;
+    return false;
+}
+
+void HarpSynchronizer::set_harp_time_us_64(uint64_t harp_time_us)
+{
+    // The sync uart interrupt also publishes clock models.
+    uint32_t interrupt_status = hal_save_and_disable_interrupts();
+    self->set_clock_model({hal_time_us_64(), harp_time_us, self->drift_q32_});
+    hal_restore_interrupts(interrupt_status);
+}
+
+void HarpSynchronizer::update()
+{
+    if (!self->locked_)
+        return;
+    // Keep the sync uart interrupt from updating the model underneath us.
+    uint32_t interrupt_status = hal_save_and_disable_interrupts();
+    uint64_t curr_system_us = hal_time_us_64();
+    bool link_lost = (curr_system_us - self->last_packet_system_us_
+                      > self->sync_timeout_us_);
+    // Packets that keep arriving but are rejected (i.e: a few delayed ones in
+    // a row) keep the lock. Stop slewing, though, since the last phase
+    // correction was only meant for one sync period.
+    bool stale = (curr_system_us - self->last_sync_system_us_
+                  > self->sync_timeout_us_);
+    if ((link_lost || stale) && !self->coasting_)
+    {
+        // Drop the phase correction and free-run at the drift estimate.
+        uint64_t curr_harp_us = system_to_harp_us_64(curr_system_us,
+                                                     self->clock_model());
+        self->set_clock_model({curr_system_us, curr_harp_us,
+                               self->drift_q32_});
+        self->coasting_ = true;
+    }
+    if (link_lost)
+    {
+        // Holdover.
+        self->locked_ = false;
+        ++self->lock_losses_;
+        // Accept the first packets after holdover even if holdover drifted.
+        // The filter is kept while the link is alive, so that rejecting
+        // packets cannot lock the filter out.
+        self->residual_count_ = 0;
+    }
+    hal_restore_interrupts(interrupt_status);
+}
+
+HarpSynchronizer::SyncStats HarpSynchronizer::stats()
+{
+    // Keep the sync uart interrupt from updating the stats underneath us.
+    uint32_t interrupt_status = hal_save_and_disable_interrupts();
+    SyncStats stats{self->last_residual_ns_, self->mean_residual_ns_,
+                    self->jitter_ns_,
+                    // Convert from parts-per-2^32 to parts-per-billion.
+                    int32_t((int64_t(self->drift_q32_) * 1'000'000'000) >> 32),
+                    self->packets_received_, self->packets_rejected_,
+                    self->lock_losses_,
+                    self->has_synced_?
+                        hal_time_us_64() - self->last_sync_system_us_:
+                        UINT64_MAX};
+    hal_restore_interrupts(interrupt_status);
+    return stats;
+}
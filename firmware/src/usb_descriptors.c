@@ -83,7 +83,7 @@
 #define USBD_CDC_EP_OUT (0x02)
 #define USBD_CDC_EP_IN (0x82)
 #define USBD_CDC_CMD_MAX_SIZE (8)
-#define USBD_CDC_IN_OUT_MAX_SIZE (64)
+// Note: USBD_CDC_IN_OUT_MAX_SIZE is defined in tusb_config.h.
 
 #define USBD_STR_0 (0x00)
 #define USBD_STR_MANUF (0x01)
@@ -0,0 +1,716 @@
+// Host benchmark of the harp core's parse, dispatch, and reply path.
+// Runs the real HarpCApp against the simulated usb transport (harp_hal_sim.h)
+// and reports READ, WRITE, DUMP, and EVENT throughput as JSON. With
+// --latency, reports reply latency and idle time for sparse requests with
+// each idle policy instead.
+#include <harp_c_app.h>
+#include <harp_hal_sim.h>
+#include <core_registers.h>
+#include <reg_types.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#define DEFAULT_MESSAGES (100'000) // Request messages sent per case.
+#define DEFAULT_REPEATS (5) // Times each case is run. Median is reported.
+#define STALL_LIMIT (10'000) // run() calls without a reply before giving up.
+#define DEFAULT_LATENCY_REQUESTS (10'000) // Requests sent with --latency.
+#define DEFAULT_INTERVAL_US (1'000) // Mean time between requests with
+                                    // --latency.
+#define LATENCY_STALL_US (1'000'000) // Time without a reply before giving
+                                     // up with --latency.
+#define DEFAULT_RUN_NS (2'000) // Modeled cost of one run() call with
+                               // --latency.
+#define DEFAULT_BYTE_NS (50) // Modeled cost per usb byte read or written with
+                             // --latency.
+#define DEFAULT_WAKE_US (2) // Modeled time to resume from __wfe() with
+                            // --latency.
+#define DEFAULT_BURST (32) // Back-to-back requests per arrival in the loaded
+                           // --latency case.
+
+// Create device name array.
+const uint16_t who_am_i = 1234;
+const uint8_t hw_version_major = 1;
+const uint8_t hw_version_minor = 0;
+const uint8_t assembly_version = 2;
+const uint8_t harp_version_major = 2;
+const uint8_t harp_version_minor = 0;
+const uint8_t fw_version_major = 3;
+const uint8_t fw_version_minor = 0;
+const uint16_t serial_number = 0xCAFE;
+
+#ifndef GIT_HASH
+#define GIT_HASH "unknown"
+#endif
+
+// Harp App Register Setup. One register per payload type and size under test.
+const size_t reg_count = 9;
+
+#pragma pack(push, 1)
+struct app_regs_t
+{
+    volatile uint8_t u8;             // app register 0
+    volatile int16_t s16;            // app register 1
+    volatile uint32_t u32;           // app register 2
+    volatile uint64_t u64;           // app register 3
+    volatile float f32;              // app register 4
+    volatile uint8_t u8_x16[16];     // app register 5
+    volatile uint32_t u32_x16[16];   // app register 6
+    volatile float f32_x16[16];      // app register 7
+    volatile uint8_t u8_x200[200];   // app register 8
+} app_regs;
+#pragma pack(pop)
+
+RegSpecs app_reg_specs[reg_count]
+{
+    {(uint8_t*)&app_regs.u8, sizeof(app_regs.u8), U8},
+    {(uint8_t*)&app_regs.s16, sizeof(app_regs.s16), S16},
+    {(uint8_t*)&app_regs.u32, sizeof(app_regs.u32), U32},
+    {(uint8_t*)&app_regs.u64, sizeof(app_regs.u64), U64},
+    {(uint8_t*)&app_regs.f32, sizeof(app_regs.f32), Float},
+    {(uint8_t*)&app_regs.u8_x16, sizeof(app_regs.u8_x16), U8},
+    {(uint8_t*)&app_regs.u32_x16, sizeof(app_regs.u32_x16), U32},
+    {(uint8_t*)&app_regs.f32_x16, sizeof(app_regs.f32_x16), Float},
+    {(uint8_t*)&app_regs.u8_x200, sizeof(app_regs.u8_x200), U8}
+};
+
+RegFnPair reg_handler_fns[reg_count]
+{
+    {&HarpCore::read_reg_generic, &HarpCore::write_reg_generic},
+    {&HarpCore::read_reg_generic, &HarpCore::write_reg_generic},
+    {&HarpCore::read_reg_generic, &HarpCore::write_reg_generic},
+    {&HarpCore::read_reg_generic, &HarpCore::write_reg_generic},
+    {&HarpCore::read_reg_generic, &HarpCore::write_reg_generic},
+    {&HarpCore::read_reg_generic, &HarpCore::write_reg_generic},
+    {&HarpCore::read_reg_generic, &HarpCore::write_reg_generic},
+    {&HarpCore::read_reg_generic, &HarpCore::write_reg_generic},
+    {&HarpCore::read_reg_generic, &HarpCore::write_reg_generic}
+};
+
+void app_reset(){}
+
+void update_app_state(){}
+
+/**
+ * \brief one benchmark case: a stream of identical requests (or posted
+ *  events) to one register.
+ */
+struct bench_case_t
+{
+    std::string name;
+    msg_type_t type; // READ, WRITE, or EVENT. A DUMP is a WRITE to
+                     // OPERATION_CTRL with the DUMP bit set.
+    uint8_t address;
+    reg_type_t payload_type;
+    uint8_t num_bytes;
+};
+
+struct bench_result_t
+{
+    bench_case_t bench_case;
+    uint32_t messages;
+    uint32_t replies_per_msg;
+    uint64_t reply_bytes;
+    uint32_t error_replies;
+    double ns_per_msg_median;
+    double ns_per_msg_min;
+    sim_cdc_stats_t usb_stats;
+};
+
+/**
+ * \brief counts the frames the device sends to the PC, even if they are split
+ *  across reads. Only looks at frame headers.
+ */
+struct FrameCounter
+{
+    uint32_t frames = 0;
+    uint32_t error_frames = 0;
+    uint64_t bytes = 0;
+    uint16_t frame_bytes_left = 0; // bytes until the next frame header.
+    uint8_t header_bytes_seen = 0;
+    uint8_t header[2];
+
+    void consume(const uint8_t* data, size_t num_bytes)
+    {
+        bytes += num_bytes;
+        size_t i = 0;
+        while (i < num_bytes)
+        {
+            if (frame_bytes_left > 0)
+            {
+                size_t skip = std::min<size_t>(frame_bytes_left, num_bytes - i);
+                frame_bytes_left -= skip;
+                i += skip;
+                continue;
+            }
+            header[header_bytes_seen++] = data[i++];
+            if (header_bytes_seen < 2)
+                continue;
+            header_bytes_seen = 0;
+            frame_bytes_left = header[1]; // raw_length bytes follow.
+            ++frames;
+            if ((header[0] == READ_ERROR) || (header[0] == WRITE_ERROR))
+                ++error_frames;
+        }
+    }
+};
+
+uint8_t pc_rx_buffer[4096];
+
+/**
+ * \brief read everything the device has sent to the PC.
+ */
+void drain_pc(FrameCounter& counter)
+{
+    size_t num_bytes;
+    while ((num_bytes = sim_cdc_pc_read(pc_rx_buffer, sizeof(pc_rx_buffer))))
+        counter.consume(pc_rx_buffer, num_bytes);
+}
+
+/**
+ * \brief one iteration of the device's main loop. Time advances 1[us] per
+ *  iteration so that time-based behavior (i.e: FLUSH_COALESCE) still works.
+ */
+void run_device(HarpCApp& app)
+{
+    app.run();
+    sim_clock_advance_us(1);
+}
+
+/**
+ * \brief reply latency and idle time for sparse requests with one idle
+ *  policy.
+ */
+struct latency_result_t
+{
+    const char* idle_policy;
+    uint32_t requests;
+    uint32_t burst; ///< requests sent back-to-back per arrival.
+    uint32_t interval_us;
+    double latency_mean_us;
+    double latency_p50_us;
+    double latency_p99_us;
+    double latency_max_us;
+    double rx_wait_mean_us; ///< from arrival to dispatch, per R_RX_LATENCY.
+    double rx_wait_max_us;
+    double idle_fraction;
+    double runs_per_s;
+};
+
+/**
+ * \brief serialize a PC-to-device request.
+ */
+std::vector<uint8_t> make_request(msg_type_t type, uint8_t address,
+                                  reg_type_t payload_type,
+                                  const uint8_t* payload, uint8_t num_bytes)
+{
+    std::vector<uint8_t> msg(sizeof(msg_header_t) + num_bytes + 1);
+    msg[0] = type;
+    msg[1] = 4 + num_bytes; // raw_length
+    msg[2] = address;
+    msg[3] = 255; // port
+    msg[4] = payload_type;
+    for (uint8_t i = 0; i < num_bytes; ++i)
+        msg[sizeof(msg_header_t) + i] = payload[i];
+    uint8_t checksum = 0;
+    for (size_t i = 0; i + 1 < msg.size(); ++i)
+        checksum += msg[i];
+    msg.back() = checksum;
+    return msg;
+}
+
+/**
+ * \brief the request message for a READ, WRITE, or DUMP case.
+ */
+std::vector<uint8_t> make_case_request(const bench_case_t& bench_case)
+{
+    std::vector<uint8_t> payload(bench_case.num_bytes);
+    for (size_t i = 0; i < payload.size(); ++i)
+        payload[i] = uint8_t(i);
+    if (bench_case.address == OPERATION_CTRL) // DUMP: ACTIVE mode, no ALIVE_EN.
+        payload[0] = ACTIVE | (1u << DUMP_OFFSET);
+    uint8_t num_bytes = (bench_case.type == READ)? 0: bench_case.num_bytes;
+    return make_request(bench_case.type, bench_case.address,
+                        bench_case.payload_type, payload.data(), num_bytes);
+}
+
+/**
+ * \brief send \p messages requests (or post \p messages events) and run the
+ *  device until all replies arrive.
+ * \return elapsed time in nanoseconds or a negative value if the device
+ *  stopped replying.
+ */
+double run_case(HarpCApp& app, const bench_case_t& bench_case,
+                uint32_t messages, uint32_t replies_per_msg,
+                FrameCounter& counter)
+{
+    const uint32_t expected_frames = messages * replies_per_msg;
+    std::vector<uint8_t> stream;
+    if (bench_case.type != EVENT)
+    {
+        std::vector<uint8_t> request = make_case_request(bench_case);
+        stream.reserve(request.size() * messages);
+        for (uint32_t i = 0; i < messages; ++i)
+            stream.insert(stream.end(), request.begin(), request.end());
+    }
+    const size_t event_capacity = HARP_EVENT_QUEUE_SIZE;
+    size_t sent = 0; // bytes sent or events posted.
+    uint32_t idle_runs = 0;
+    auto start_time = std::chrono::steady_clock::now();
+    while (counter.frames < expected_frames)
+    {
+        // PC side: keep the device's rx FIFO full.
+        if (bench_case.type == EVENT)
+        {
+            for (size_t i = 0; (i < event_capacity) && (sent < messages); ++i)
+            {
+                HarpCore::post_event_from_isr(bench_case.address);
+                ++sent;
+            }
+        }
+        else if (sent < stream.size())
+            sent += sim_cdc_pc_write(stream.data() + sent,
+                                     stream.size() - sent);
+        run_device(app);
+        uint32_t prev_frames = counter.frames;
+        drain_pc(counter);
+        idle_runs = (counter.frames == prev_frames)? idle_runs + 1: 0;
+        if (idle_runs > STALL_LIMIT)
+            return -1;
+    }
+    auto stop_time = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(stop_time
+                                                    - start_time).count();
+}
+
+/**
+ * \brief send one request and count the replies it generates.
+ */
+uint32_t count_replies_per_msg(HarpCApp& app, const bench_case_t& bench_case)
+{
+    FrameCounter counter;
+    if (bench_case.type == EVENT)
+        HarpCore::post_event_from_isr(bench_case.address);
+    else
+    {
+        std::vector<uint8_t> request = make_case_request(bench_case);
+        sim_cdc_pc_write(request.data(), request.size());
+    }
+    for (uint32_t i = 0; i < STALL_LIMIT; ++i)
+        run_device(app);
+    drain_pc(counter);
+    return counter.frames;
+}
+
+bench_result_t benchmark(HarpCApp& app, const bench_case_t& bench_case,
+                         uint32_t messages, uint32_t repeats)
+{
+    bench_result_t result{bench_case, messages, 0, 0, 0, 0, 0, {}};
+    result.replies_per_msg = count_replies_per_msg(app, bench_case);
+    std::vector<double> ns_per_msg;
+    for (uint32_t i = 0; i < repeats; ++i)
+    {
+        sim_cdc_stats_t start_stats = sim_cdc_stats();
+        FrameCounter counter;
+        double elapsed_ns = run_case(app, bench_case, messages,
+                                     result.replies_per_msg, counter);
+        if (elapsed_ns < 0)
+        {
+            fprintf(stderr, "%s: device stopped replying after %u of %u "
+                    "replies.\n", bench_case.name.c_str(), counter.frames,
+                    messages * result.replies_per_msg);
+            exit(EXIT_FAILURE);
+        }
+        ns_per_msg.push_back(elapsed_ns / messages);
+        sim_cdc_stats_t stop_stats = sim_cdc_stats();
+        result.reply_bytes = counter.bytes;
+        result.error_replies = counter.error_frames;
+        result.usb_stats = {stop_stats.full_packets - start_stats.full_packets,
+                            stop_stats.short_packets - start_stats.short_packets,
+                            stop_stats.bytes_to_pc - start_stats.bytes_to_pc,
+                            stop_stats.bytes_from_pc - start_stats.bytes_from_pc};
+    }
+    std::sort(ns_per_msg.begin(), ns_per_msg.end());
+    result.ns_per_msg_median = ns_per_msg[ns_per_msg.size() / 2];
+    result.ns_per_msg_min = ns_per_msg.front();
+    return result;
+}
+
+/**
+ * \brief send \p requests READs of one app register in bursts of \p burst
+ *  back-to-back requests at random times, \p interval_us apart on average,
+ *  and time each reply.
+ * \details run() is called in a loop, and its work is charged to the
+ *  simulated clock with the costs set by sim_cpu_set_costs(). Latency is
+ *  measured from the time a request reaches the device's rx FIFO to the end
+ *  of the run() call that replied to it.
+ */
+latency_result_t measure_latency(HarpCApp& app, idle_policy_t idle_policy,
+                                 uint32_t requests, uint32_t burst,
+                                 uint32_t interval_us)
+{
+    HarpCore::set_idle_policy(idle_policy);
+    std::vector<uint8_t> request = make_request(READ, APP_REG_START_ADDRESS,
+                                                U8, nullptr, 0);
+    std::vector<uint8_t> requests_burst;
+    for (uint32_t i = 0; i < burst; ++i)
+        requests_burst.insert(requests_burst.end(), request.begin(),
+                              request.end());
+    // Schedule every request up front, like usb interrupts to come.
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<uint32_t> gap_us(interval_us / 2,
+                                                   interval_us * 3 / 2);
+    const uint64_t start_us = hal_time_us_64();
+    std::vector<uint64_t> arrivals_us;
+    uint64_t arrival_us = start_us;
+    requests -= requests % burst;
+    for (uint32_t i = 0; i < requests; i += burst)
+    {
+        arrival_us += gap_us(rng);
+        arrivals_us.insert(arrivals_us.end(), burst, arrival_us);
+        sim_cdc_pc_write_at(arrival_us, requests_burst.data(),
+                            requests_burst.size());
+    }
+    const sim_idle_stats_t start_idle = sim_idle_stats();
+    const volatile RxLatency& rx_latency = HarpCore::rx_latency();
+    const uint32_t start_rx_messages = rx_latency.messages;
+    const uint32_t start_rx_wait_us = rx_latency.total_wait_us;
+    uint32_t rx_messages = start_rx_messages;
+    uint32_t rx_wait_max_us = 0;
+    FrameCounter counter;
+    uint64_t runs = 0;
+    std::vector<double> latencies_us;
+    while (counter.frames < requests)
+    {
+        app.run();
+        ++runs;
+        // Requests in a burst arrive together and are dispatched in order,
+        // so the last one a run() call dispatches has waited the longest.
+        if (rx_latency.messages != rx_messages)
+        {
+            rx_messages = rx_latency.messages;
+            rx_wait_max_us = std::max(rx_wait_max_us,
+                                      uint32_t(rx_latency.last_wait_us));
+        }
+        uint32_t prev_frames = counter.frames;
+        drain_pc(counter);
+        for (uint32_t i = prev_frames; i < counter.frames; ++i)
+            latencies_us.push_back(double(hal_time_us_64() - arrivals_us[i]));
+        if ((counter.frames < requests) && (hal_time_us_64()
+                > arrivals_us[counter.frames] + LATENCY_STALL_US))
+        {
+            fprintf(stderr, "LATENCY: device stopped replying after %u of %u "
+                    "replies.\n", counter.frames, requests);
+            exit(EXIT_FAILURE);
+        }
+    }
+    const double elapsed_us = double(hal_time_us_64() - start_us);
+    const sim_idle_stats_t stop_idle = sim_idle_stats();
+    HarpCore::set_idle_policy(IDLE_POLL);
+
+    latency_result_t result{(idle_policy == IDLE_SLEEP)? "sleep": "poll",
+                            requests, burst, interval_us,
+                            0, 0, 0, 0, 0, 0, 0, 0};
+    for (double latency_us: latencies_us)
+        result.latency_mean_us += latency_us;
+    result.latency_mean_us /= latencies_us.size();
+    std::sort(latencies_us.begin(), latencies_us.end());
+    result.latency_p50_us = latencies_us[latencies_us.size() / 2];
+    result.latency_p99_us = latencies_us[std::min(
+        size_t(std::ceil(0.99 * latencies_us.size())),
+        latencies_us.size() - 1)];
+    result.latency_max_us = latencies_us.back();
+    result.rx_wait_mean_us = double(rx_latency.total_wait_us
+                                    - start_rx_wait_us)
+                             / (rx_latency.messages - start_rx_messages);
+    result.rx_wait_max_us = rx_wait_max_us;
+    result.idle_fraction = double(stop_idle.idle_us - start_idle.idle_us)
+                           / elapsed_us;
+    result.runs_per_s = runs / (elapsed_us * 1e-6);
+    return result;
+}
+
+const char* payload_type_name(reg_type_t payload_type)
+{
+    switch (payload_type)
+    {
+        case U8: return "U8";
+        case S8: return "S8";
+        case U16: return "U16";
+        case S16: return "S16";
+        case U32: return "U32";
+        case S32: return "S32";
+        case U64: return "U64";
+        case S64: return "S64";
+        case Float: return "Float";
+        default: return "unknown";
+    }
+}
+
+const char* msg_type_name(const bench_case_t& bench_case)
+{
+    if (bench_case.address == OPERATION_CTRL)
+        return "DUMP";
+    switch (bench_case.type)
+    {
+        case READ: return "READ";
+        case WRITE: return "WRITE";
+        case EVENT: return "EVENT";
+        default: return "unknown";
+    }
+}
+
+void print_json(FILE* file, const std::vector<bench_result_t>& results,
+                const char* flush_policy, uint32_t repeats)
+{
+    fprintf(file, "{\n");
+    fprintf(file, "  \"benchmark\": \"harp_host_benchmark\",\n");
+    fprintf(file, "  \"git_hash\": \"%s\",\n", GIT_HASH);
+    fprintf(file, "  \"flush_policy\": \"%s\",\n", flush_policy);
+    fprintf(file, "  \"repeats\": %u,\n", repeats);
+    fprintf(file, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const bench_result_t& r = results[i];
+        const bench_case_t& c = r.bench_case;
+        fprintf(file, "    {\"name\": \"%s\", \"type\": \"%s\", "
+                "\"address\": %u, \"payload_type\": \"%s\", "
+                "\"payload_bytes\": %u, \"messages\": %u, "
+                "\"replies_per_msg\": %u, \"reply_bytes\": %llu, "
+                "\"error_replies\": %u, "
+                "\"ns_per_msg\": %.1f, \"ns_per_msg_min\": %.1f, "
+                "\"msgs_per_s\": %.0f, \"ns_per_reply\": %.1f, "
+                "\"usb_full_packets\": %u, \"usb_short_packets\": %u}%s\n",
+                c.name.c_str(), msg_type_name(c), c.address,
+                payload_type_name(c.payload_type), c.num_bytes, r.messages,
+                r.replies_per_msg, (unsigned long long)r.reply_bytes,
+                r.error_replies, r.ns_per_msg_median, r.ns_per_msg_min,
+                1e9 / r.ns_per_msg_median,
+                r.ns_per_msg_median / r.replies_per_msg,
+                r.usb_stats.full_packets, r.usb_stats.short_packets,
+                (i + 1 < results.size())? ",": "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+void print_latency_json(FILE* file,
+                        const std::vector<latency_result_t>& results,
+                        const char* flush_policy,
+                        const sim_cpu_costs_t& cpu_costs)
+{
+    fprintf(file, "{\n");
+    fprintf(file, "  \"benchmark\": \"harp_host_benchmark\",\n");
+    fprintf(file, "  \"git_hash\": \"%s\",\n", GIT_HASH);
+    fprintf(file, "  \"flush_policy\": \"%s\",\n", flush_policy);
+    fprintf(file, "  \"run_ns\": %u,\n", cpu_costs.run_ns);
+    fprintf(file, "  \"byte_ns\": %u,\n", cpu_costs.byte_ns);
+    fprintf(file, "  \"wake_us\": %u,\n", cpu_costs.wake_us);
+    fprintf(file, "  \"latency_results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const latency_result_t& r = results[i];
+        fprintf(file, "    {\"idle_policy\": \"%s\", \"requests\": %u, "
+                "\"burst\": %u, "
+                "\"interval_us\": %u, \"latency_mean_us\": %.2f, "
+                "\"latency_p50_us\": %.1f, \"latency_p99_us\": %.1f, "
+                "\"latency_max_us\": %.1f, \"rx_wait_mean_us\": %.2f, "
+                "\"rx_wait_max_us\": %.0f, \"idle_fraction\": %.4f, "
+                "\"runs_per_s\": %.0f}%s\n",
+                r.idle_policy, r.requests, r.burst, r.interval_us,
+                r.latency_mean_us,
+                r.latency_p50_us, r.latency_p99_us, r.latency_max_us,
+                r.rx_wait_mean_us, r.rx_wait_max_us, r.idle_fraction, r.runs_per_s,
+                (i + 1 < results.size())? ",": "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+void print_usage(const char* program)
+{
+    fprintf(stderr,
+            "Usage: %s [--messages N] [--repeats N] "
+            "[--flush-policy per_msg|per_run|coalesce] [--filter TEXT] "
+            "[--latency] [--interval-us N] [--run-ns N] [--byte-ns N] "
+            "[--wake-us N] [--burst N] [--output FILE]\n", program);
+}
+
+int main(int argc, char* argv[])
+{
+    uint32_t messages = 0; // 0 picks the default for the mode.
+    uint32_t repeats = DEFAULT_REPEATS;
+    bool latency = false;
+    uint32_t interval_us = DEFAULT_INTERVAL_US;
+    uint32_t burst = DEFAULT_BURST;
+    sim_cpu_costs_t cpu_costs{DEFAULT_RUN_NS, DEFAULT_BYTE_NS,
+                              DEFAULT_WAKE_US};
+    std::string flush_policy = "per_run";
+    std::string filter;
+    const char* output_path = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if ((i + 1 < argc) && (arg == "--messages"))
+            messages = strtoul(argv[++i], nullptr, 10);
+        else if ((i + 1 < argc) && (arg == "--repeats"))
+            repeats = strtoul(argv[++i], nullptr, 10);
+        else if ((i + 1 < argc) && (arg == "--flush-policy"))
+            flush_policy = argv[++i];
+        else if ((i + 1 < argc) && (arg == "--filter"))
+            filter = argv[++i];
+        else if ((i + 1 < argc) && (arg == "--output"))
+            output_path = argv[++i];
+        else if (arg == "--latency")
+            latency = true;
+        else if ((i + 1 < argc) && (arg == "--interval-us"))
+            interval_us = strtoul(argv[++i], nullptr, 10);
+        else if ((i + 1 < argc) && (arg == "--run-ns"))
+            cpu_costs.run_ns = strtoul(argv[++i], nullptr, 10);
+        else if ((i + 1 < argc) && (arg == "--byte-ns"))
+            cpu_costs.byte_ns = strtoul(argv[++i], nullptr, 10);
+        else if ((i + 1 < argc) && (arg == "--wake-us"))
+            cpu_costs.wake_us = strtoul(argv[++i], nullptr, 10);
+        else if ((i + 1 < argc) && (arg == "--burst"))
+            burst = strtoul(argv[++i], nullptr, 10);
+        else
+        {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (messages == 0)
+        messages = latency? DEFAULT_LATENCY_REQUESTS: DEFAULT_MESSAGES;
+    // Polling only moves the clock through the cost of run().
+    // A burst of READs must fit in the device's usb rx FIFO.
+    const size_t read_size = sizeof(msg_header_t) + 1;
+    if ((repeats == 0) || (interval_us < 2) || (cpu_costs.run_ns == 0)
+        || (burst == 0) || (burst * read_size > CFG_TUD_CDC_RX_BUFSIZE))
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Time only moves when the device's main loop runs, so results do not
+    // depend on timeouts or heartbeats.
+    sim_reset();
+    sim_clock_set_manual(true);
+    HarpCApp& app = HarpCApp::init(who_am_i, hw_version_major,
+                                   hw_version_minor, assembly_version,
+                                   harp_version_major, harp_version_minor,
+                                   fw_version_major, fw_version_minor,
+                                   serial_number, "Host Benchmark",
+                                   (const uint8_t*)GIT_HASH, &app_regs,
+                                   app_reg_specs, reg_handler_fns, reg_count,
+                                   update_app_state, app_reset);
+    if (flush_policy == "per_msg")
+        HarpCore::set_tx_flush_policy(FLUSH_PER_MSG);
+    else if (flush_policy == "per_run")
+        HarpCore::set_tx_flush_policy(FLUSH_PER_RUN);
+    else if (flush_policy == "coalesce")
+        HarpCore::set_tx_flush_policy(FLUSH_COALESCE);
+    else
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    // Go ACTIVE so that events are sent, but turn off the heartbeat so that
+    // only the replies under test reach the PC.
+    uint8_t op_ctrl = ACTIVE;
+    std::vector<uint8_t> request = make_request(WRITE, OPERATION_CTRL, U8,
+                                                &op_ctrl, 1);
+    sim_cdc_pc_write(request.data(), request.size());
+    for (uint32_t i = 0; i < STALL_LIMIT; ++i)
+        run_device(app);
+    sim_cdc_pc_discard();
+
+    FILE* file = stdout;
+    if (output_path != nullptr)
+    {
+        file = fopen(output_path, "w");
+        if (file == nullptr)
+        {
+            fprintf(stderr, "Could not open %s.\n", output_path);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (latency)
+    {
+        sim_cpu_set_costs(cpu_costs);
+        std::vector<latency_result_t> results;
+        // Sparse single requests, then back-to-back bursts of them.
+        for (uint32_t requests_per_arrival: {1u, burst})
+        {
+            for (idle_policy_t idle_policy: {IDLE_POLL, IDLE_SLEEP})
+            {
+                results.push_back(measure_latency(app, idle_policy, messages,
+                                                  requests_per_arrival,
+                                                  interval_us));
+                const latency_result_t& r = results.back();
+                std::string name = std::string(r.idle_policy) + "/x"
+                                   + std::to_string(r.burst);
+                fprintf(stderr, "LATENCY/%-9s latency [us]: mean %.2f | "
+                        "p50 %.1f | p99 %.1f | max %.1f   rx wait [us]: "
+                        "mean %.2f | max %.0f   idle %5.1f%%   %9.0f runs/s\n",
+                        name.c_str(), r.latency_mean_us, r.latency_p50_us,
+                        r.latency_p99_us, r.latency_max_us,
+                        r.rx_wait_mean_us, r.rx_wait_max_us,
+                        r.idle_fraction * 100, r.runs_per_s);
+            }
+        }
+        print_latency_json(file, results, flush_policy.c_str(), cpu_costs);
+        if (file != stdout)
+            fclose(file);
+        return EXIT_SUCCESS;
+    }
+
+    std::vector<bench_case_t> cases;
+    for (msg_type_t type: {READ, WRITE})
+    {
+        for (size_t i = 0; i < reg_count; ++i)
+        {
+            const RegSpecs& specs = app_reg_specs[i];
+            uint8_t type_size = specs.payload_type
+                                & ~(IS_SIGNED | IS_FLOAT | HAS_TIMESTAMP);
+            std::string name = std::string(type == READ? "READ": "WRITE")
+                + "/" + payload_type_name(specs.payload_type)
+                + "x" + std::to_string(specs.num_bytes / type_size);
+            cases.push_back({name, type, uint8_t(APP_REG_START_ADDRESS + i),
+                             specs.payload_type, specs.num_bytes});
+        }
+    }
+    cases.push_back({"DUMP", WRITE, OPERATION_CTRL, U8, 1});
+    // Events carry at most HARP_EVENT_MAX_PAYLOAD_SIZE bytes.
+    for (size_t i = 0; i < reg_count; ++i)
+    {
+        const RegSpecs& specs = app_reg_specs[i];
+        if (specs.num_bytes > HARP_EVENT_MAX_PAYLOAD_SIZE)
+            continue;
+        cases.push_back({std::string("EVENT/")
+                         + payload_type_name(specs.payload_type) + "x1",
+                         EVENT, uint8_t(APP_REG_START_ADDRESS + i),
+                         specs.payload_type, specs.num_bytes});
+    }
+
+    std::vector<bench_result_t> results;
+    for (const bench_case_t& bench_case: cases)
+    {
+        if (!filter.empty() && (bench_case.name.find(filter) == std::string::npos))
+            continue;
+        results.push_back(benchmark(app, bench_case, messages, repeats));
+        const bench_result_t& r = results.back();
+        fprintf(stderr, "%-16s %10.1f ns/msg %12.0f msgs/s\n",
+                bench_case.name.c_str(), r.ns_per_msg_median,
+                1e9 / r.ns_per_msg_median);
+    }
+
+    print_json(file, results, flush_policy.c_str(), repeats);
+    if (file != stdout)
+        fclose(file);
+    return EXIT_SUCCESS;
+}
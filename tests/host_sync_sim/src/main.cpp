@@ -0,0 +1,611 @@
+// Host simulation of the harp clock sync signal.
+// Generates the 100[kbaud] sync packet stream byte by byte against the
+// simulated clock (harp_hal_sim.h) and runs the real HarpSynchronizer on it
+// with a drifting local crystal, interrupt latency, line errors, and cable
+// unplugs. Optionally repeats the synchronized clock with a
+// HarpClockGenerator, like a device with CLK_REP set. Reports the
+// distribution of the synchronizer's Harp time error (and the repeated
+// packets' timing error) as JSON.
+#include <harp_synchronizer.h>
+#include <harp_clock_generator.h>
+#include <harp_hal_sim.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#define DEFAULT_SECONDS (600) // Simulated run time.
+#define DEFAULT_WARMUP_S (30) // Initial seconds left out of the locked stats.
+#define DEFAULT_SAMPLE_US (10'000) // Harp time error sampling period.
+#define DEFAULT_SEED (1)
+#define START_HARP_S (1'000'000) // Harp time (in [s]) when the run starts.
+#define START_SYSTEM_US (12'345'678) // System time when the run starts.
+#define SYNC_UART_RX_PIN (5)
+#define REPEATER_UART_TX_PIN (0)
+#define RX_INTERRUPT_DELAY_US (95) // from a byte's start edge until it is
+                                   // readable and raises its rx interrupt.
+                                   // The uart samples the middle of the stop
+                                   // bit.
+#define RX_TIMEOUT_DELAY_US (RX_INTERRUPT_DELAY_US + 320) // from the last
+                                   // byte's start edge to the rx timeout
+                                   // interrupt (32 bit periods later).
+
+#ifndef GIT_HASH
+#define GIT_HASH "unknown"
+#endif
+
+struct sim_config_t
+{
+    uint32_t seconds = DEFAULT_SECONDS;
+    uint32_t warmup_s = DEFAULT_WARMUP_S;
+    uint32_t sample_us = DEFAULT_SAMPLE_US;
+    bool edge_capture = true;
+    double ppm = 0; // crystal error. Positive if the local clock runs fast.
+    double wander_ppb = 0; // std deviation of the crystal's change per [s].
+    double latency_us = 0; // max (uniform) interrupt latency.
+    double spike_prob = 0; // chance that an interrupt is delayed further.
+    double spike_us = 0; // extra latency of a delayed interrupt.
+    double drop_prob = 0; // chance that a byte is lost on the line.
+    double corrupt_prob = 0; // chance that a byte has a flipped bit.
+    std::vector<std::pair<double, double>> unplugs; // (start, duration) [s].
+    int64_t outlier_bound_us = -1; // -1 keeps the synchronizer's default.
+    uint32_t seed = DEFAULT_SEED;
+    double max_error_us = 0; // fail if exceeded while locked. 0 disables.
+    int64_t max_lock_losses = -1; // fail if exceeded. -1 disables.
+    bool repeat = false; // repeat the clock while locked.
+};
+
+/**
+ * \brief the device's crystal: maps true time to system time.
+ */
+class LocalClock
+{
+public:
+    explicit LocalClock(double ppm)
+    :base_true_us_{0}, base_system_us_{START_SYSTEM_US}, ppm_{ppm}
+    {}
+
+    double system_us(double true_us) const
+    {return base_system_us_ + (true_us - base_true_us_) * (1 + ppm_ * 1e-6);}
+
+    double true_us(double system_us) const
+    {return base_true_us_ + (system_us - base_system_us_) / (1 + ppm_ * 1e-6);}
+
+/**
+ * \brief change the crystal error from \p true_us on, keeping system time
+ *  continuous.
+ */
+    void set_ppm(double true_us, double ppm)
+    {
+        base_system_us_ = system_us(true_us);
+        base_true_us_ = true_us;
+        ppm_ = ppm;
+    }
+
+    double ppm() const
+    {return ppm_;}
+
+private:
+    double base_true_us_;
+    double base_system_us_;
+    double ppm_;
+};
+
+enum sim_event_type_t
+{
+    LINE_EDGE, // a byte's start edge.
+    BYTE_RECEIVED, // a byte becomes readable.
+    RX_INTERRUPT
+};
+
+struct sim_event_t
+{
+    double true_us;
+    uint64_t order; // breaks ties in scheduling order.
+    sim_event_type_t type;
+    uint8_t byte;
+
+    bool operator>(const sim_event_t& other) const
+    {
+        return (true_us > other.true_us)
+               || ((true_us == other.true_us) && (order > other.order));
+    }
+};
+
+struct error_stats_t
+{
+    uint32_t samples;
+    double mean_us;
+    double p50_abs_us;
+    double p95_abs_us;
+    double p99_abs_us;
+    double max_abs_us;
+};
+
+struct sim_result_t
+{
+    uint32_t packets_sent;
+    uint32_t bytes_dropped;
+    uint32_t bytes_corrupted;
+    HarpSynchronizer::SyncStats sync_stats;
+    double first_lock_s; // negative if never locked.
+    double true_drift_ppb; // in the synchronizer's convention.
+    error_stats_t locked;
+    error_stats_t holdover;
+    error_stats_t repeated; // start edges of repeated packets.
+};
+
+/**
+ * \brief the sync packet stream and the device's uart interrupts.
+ */
+class SyncSignal
+{
+public:
+    SyncSignal(const sim_config_t& config, std::mt19937& rng)
+    :config_{config}, rng_{rng}, next_second_{START_HARP_S + 1},
+     next_order_{0}, packets_sent_{0}, bytes_dropped_{0},
+     bytes_corrupted_{0}
+    {}
+
+/**
+ * \brief true time at the start edge of the next packet.
+ */
+    double next_packet_us() const
+    {return packet_start_us(next_second_);}
+
+/**
+ * \brief schedule the bytes and interrupts of the next packet, unless the
+ *  cable is unplugged.
+ */
+    void schedule_next_packet()
+    {
+        double start_us = packet_start_us(next_second_);
+        // The packet encodes the previous second.
+        uint32_t encoded_seconds = next_second_ - 1;
+        ++next_second_;
+        if (unplugged(start_us))
+            return;
+        ++packets_sent_;
+        uint8_t packet[HARP_SYNC_FRAME_SIZE] =
+            {HARP_SYNC_HEADER_0, HARP_SYNC_HEADER_1,
+             uint8_t(encoded_seconds), uint8_t(encoded_seconds >> 8),
+             uint8_t(encoded_seconds >> 16), uint8_t(encoded_seconds >> 24)};
+        double last_byte_us = -1;
+        for (uint8_t i = 0; i < HARP_SYNC_FRAME_SIZE; ++i)
+        {
+            // Dropped bytes still start with an edge.
+            double byte_us = start_us + i * HARP_SYNC_BYTE_DURATION_US;
+            schedule(byte_us, LINE_EDGE);
+            if (chance(config_.drop_prob))
+            {
+                ++bytes_dropped_;
+                continue;
+            }
+            uint8_t byte = packet[i];
+            if (chance(config_.corrupt_prob))
+            {
+                ++bytes_corrupted_;
+                byte ^= uint8_t(1u << (rng_() % 8));
+            }
+            schedule(byte_us + RX_INTERRUPT_DELAY_US, BYTE_RECEIVED, byte);
+            last_byte_us = byte_us;
+            if (!config_.edge_capture) // FIFO disabled: one irq per byte.
+                schedule(byte_us + RX_INTERRUPT_DELAY_US + latency_us(),
+                         RX_INTERRUPT);
+        }
+        if (config_.edge_capture && (last_byte_us >= 0))
+            schedule(last_byte_us + RX_TIMEOUT_DELAY_US + latency_us(),
+                     RX_INTERRUPT);
+    }
+
+    bool has_events() const
+    {return !events_.empty();}
+
+    const sim_event_t& next_event() const
+    {return events_.top();}
+
+    void pop_event()
+    {events_.pop();}
+
+    uint32_t packets_sent() const
+    {return packets_sent_;}
+
+    uint32_t bytes_dropped() const
+    {return bytes_dropped_;}
+
+    uint32_t bytes_corrupted() const
+    {return bytes_corrupted_;}
+
+private:
+    static double packet_start_us(uint32_t second)
+    {
+        return double(second - START_HARP_S) * 1'000'000
+               - HARP_SYNC_EDGE_OFFSET_US;
+    }
+
+    bool unplugged(double true_us) const
+    {
+        for (const auto& [start_s, duration_s]: config_.unplugs)
+        {
+            if ((true_us >= start_s * 1e6)
+                && (true_us < (start_s + duration_s) * 1e6))
+                return true;
+        }
+        return false;
+    }
+
+    bool chance(double probability)
+    {
+        return (probability > 0)
+               && (std::uniform_real_distribution<double>(0, 1)(rng_)
+                   < probability);
+    }
+
+    double latency_us()
+    {
+        double latency_us =
+            std::uniform_real_distribution<double>(0, config_.latency_us)(rng_);
+        if (chance(config_.spike_prob))
+            latency_us += config_.spike_us;
+        return latency_us;
+    }
+
+    void schedule(double true_us, sim_event_type_t type, uint8_t byte = 0)
+    {events_.push({true_us, next_order_++, type, byte});}
+
+    const sim_config_t& config_;
+    std::mt19937& rng_;
+    uint32_t next_second_; // the second announced by the next packet.
+    uint64_t next_order_;
+    uint32_t packets_sent_;
+    uint32_t bytes_dropped_;
+    uint32_t bytes_corrupted_;
+    std::priority_queue<sim_event_t, std::vector<sim_event_t>,
+                        std::greater<sim_event_t>> events_;
+};
+
+error_stats_t summarize(const std::vector<double>& errors_us)
+{
+    error_stats_t stats{uint32_t(errors_us.size()), 0, 0, 0, 0, 0};
+    if (errors_us.empty())
+        return stats;
+    std::vector<double> abs_errors_us;
+    abs_errors_us.reserve(errors_us.size());
+    for (double error_us: errors_us)
+    {
+        stats.mean_us += error_us;
+        abs_errors_us.push_back(std::fabs(error_us));
+    }
+    stats.mean_us /= errors_us.size();
+    std::sort(abs_errors_us.begin(), abs_errors_us.end());
+    auto percentile = [&](double fraction)
+    {
+        size_t index = size_t(fraction * abs_errors_us.size());
+        return abs_errors_us[std::min(index, abs_errors_us.size() - 1)];
+    };
+    stats.p50_abs_us = percentile(0.50);
+    stats.p95_abs_us = percentile(0.95);
+    stats.p99_abs_us = percentile(0.99);
+    stats.max_abs_us = abs_errors_us.back();
+    return stats;
+}
+
+/**
+ * \brief the timing error of each sync packet that the repeater sent since
+ *  the last call, after \p warmup_us.
+ */
+void read_repeated_packets(uart_inst_t* uart, const LocalClock& clock,
+                           double warmup_us, std::vector<double>& errors_us)
+{
+    // The generator writes whole packets at once.
+    sim_uart_tx_byte_t packet[HARP_SYNC_FRAME_SIZE];
+    while (sim_sync_uart_tx_read(uart, packet, HARP_SYNC_FRAME_SIZE)
+           == HARP_SYNC_FRAME_SIZE)
+    {
+        uint32_t encoded_seconds = uint32_t(packet[2].byte)
+                                   | (uint32_t(packet[3].byte) << 8)
+                                   | (uint32_t(packet[4].byte) << 16)
+                                   | (uint32_t(packet[5].byte) << 24);
+        double true_us = clock.true_us(double(packet[0].start_us));
+        double expected_true_us =
+            double(sync_frame_start_harp_us(encoded_seconds))
+            - double(START_HARP_S) * 1e6;
+        if (true_us >= warmup_us)
+            errors_us.push_back(true_us - expected_true_us);
+    }
+}
+
+/**
+ * \brief move the simulated system clock to the local time at \p true_us.
+ */
+void set_true_time(const LocalClock& clock, double true_us)
+{sim_clock_set_us(uint64_t(std::floor(clock.system_us(true_us))));}
+
+sim_result_t run(const sim_config_t& config)
+{
+    std::mt19937 rng(config.seed);
+    std::normal_distribution<double> wander_ppm(0, config.wander_ppb * 1e-3);
+    LocalClock clock(config.ppm);
+    SyncSignal signal(config, rng);
+    sim_reset();
+    sim_clock_set_manual(true);
+    set_true_time(clock, 0);
+    sim_sync_capture_set_available(config.edge_capture);
+    HarpSynchronizer& sync = HarpSynchronizer::init(uart1, SYNC_UART_RX_PIN);
+    if (config.outlier_bound_us >= 0)
+        sync.set_outlier_bound_us(uint32_t(config.outlier_bound_us));
+    if (config.repeat)
+    {
+        HarpClockGenerator::init(uart0, REPEATER_UART_TX_PIN);
+        HarpClockGenerator::set_time_source(
+            static_cast<uint64_t (*)(uint64_t)>(
+                &HarpSynchronizer::system_to_harp_us_64),
+            &HarpSynchronizer::harp_to_system_us_64);
+        // Like HarpCore::clock_changed(): re-time the scheduled packet after
+        // every correction.
+        sync.set_clock_change_callback(&HarpClockGenerator::remap);
+    }
+
+    std::vector<double> locked_errors_us;
+    std::vector<double> holdover_errors_us;
+    std::vector<double> repeated_errors_us;
+    double first_lock_s = -1;
+    const double end_us = double(config.seconds) * 1e6;
+    // Sample between packets' edges rather than on them.
+    double next_sample_us = config.sample_us / 2.0;
+    double next_wander_us = 1e6;
+    while (true)
+    {
+        double event_us = signal.has_events()? signal.next_event().true_us:
+                                               end_us;
+        double next_us = std::min({signal.next_packet_us(), next_sample_us,
+                                   next_wander_us, event_us});
+        if (next_us >= end_us)
+            break;
+        set_true_time(clock, next_us);
+        if (next_us == signal.next_packet_us())
+            signal.schedule_next_packet();
+        else if (next_us == event_us)
+        {
+            sim_event_t event = signal.next_event();
+            signal.pop_event();
+            switch (event.type)
+            {
+                case LINE_EDGE:
+                    sim_sync_line_edge();
+                    break;
+                case BYTE_RECEIVED:
+                    sim_sync_uart_receive(uart1, &event.byte, 1);
+                    break;
+                case RX_INTERRUPT:
+                    sim_sync_uart_interrupt(uart1);
+                    break;
+            }
+        }
+        else if (next_us == next_sample_us)
+        {
+            // Stand in for the main loop.
+            HarpSynchronizer::update();
+            double harp_us = double(START_HARP_S) * 1e6 + next_us;
+            double error_us = double(HarpSynchronizer::time_us_64()) - harp_us;
+            if (HarpSynchronizer::is_synced())
+            {
+                if (first_lock_s < 0)
+                    first_lock_s = next_us * 1e-6;
+                if (next_us >= config.warmup_s * 1e6)
+                    locked_errors_us.push_back(error_us);
+            }
+            else if (HarpSynchronizer::in_holdover())
+                holdover_errors_us.push_back(error_us);
+            if (config.repeat)
+            {
+                // Like HarpCore with CLK_REP set: only repeat while locked.
+                if (HarpSynchronizer::is_synced())
+                    HarpClockGenerator::start();
+                else
+                    HarpClockGenerator::stop();
+                read_repeated_packets(uart0, clock, config.warmup_s * 1e6,
+                                      repeated_errors_us);
+            }
+            next_sample_us += config.sample_us;
+        }
+        else
+        {
+            clock.set_ppm(next_us, clock.ppm() + wander_ppm(rng));
+            next_wander_us += 1e6;
+        }
+    }
+    // Harp time advances (1 / (1 + ppm)) [us] per system [us].
+    double true_drift_ppb = (1 / (1 + clock.ppm() * 1e-6) - 1) * 1e9;
+    return {signal.packets_sent(), signal.bytes_dropped(),
+            signal.bytes_corrupted(), HarpSynchronizer::stats(), first_lock_s,
+            true_drift_ppb, summarize(locked_errors_us),
+            summarize(holdover_errors_us), summarize(repeated_errors_us)};
+}
+
+void print_error_stats(FILE* file, const char* name,
+                       const error_stats_t& stats, bool last)
+{
+    fprintf(file, "  \"%s\": {\"samples\": %u, \"mean_us\": %.3f, "
+            "\"p50_abs_us\": %.3f, \"p95_abs_us\": %.3f, "
+            "\"p99_abs_us\": %.3f, \"max_abs_us\": %.3f}%s\n",
+            name, stats.samples, stats.mean_us, stats.p50_abs_us,
+            stats.p95_abs_us, stats.p99_abs_us, stats.max_abs_us,
+            last? "": ",");
+}
+
+void print_json(FILE* file, const sim_config_t& config,
+                const sim_result_t& result)
+{
+    fprintf(file, "{\n");
+    fprintf(file, "  \"benchmark\": \"harp_host_sync_sim\",\n");
+    fprintf(file, "  \"git_hash\": \"%s\",\n", GIT_HASH);
+    fprintf(file, "  \"config\": {\"seconds\": %u, \"warmup_s\": %u, "
+            "\"sample_us\": %u, \"capture\": \"%s\", \"ppm\": %.3f, "
+            "\"wander_ppb\": %.3f, \"latency_us\": %.1f, "
+            "\"spike_prob\": %g, \"spike_us\": %.1f, \"drop_prob\": %g, "
+            "\"corrupt_prob\": %g, \"outlier_bound_us\": %lld, "
+            "\"seed\": %u, \"repeat\": %s, \"unplugs\": [",
+            config.seconds, config.warmup_s, config.sample_us,
+            config.edge_capture? "edge": "isr", config.ppm,
+            config.wander_ppb, config.latency_us, config.spike_prob,
+            config.spike_us, config.drop_prob, config.corrupt_prob,
+            (long long)config.outlier_bound_us, config.seed,
+            config.repeat? "true": "false");
+    for (size_t i = 0; i < config.unplugs.size(); ++i)
+        fprintf(file, "%s[%g, %g]", (i > 0)? ", ": "",
+                config.unplugs[i].first, config.unplugs[i].second);
+    fprintf(file, "]},\n");
+    const HarpSynchronizer::SyncStats& stats = result.sync_stats;
+    fprintf(file, "  \"packets_sent\": %u,\n", result.packets_sent);
+    fprintf(file, "  \"packets_received\": %u,\n", stats.packets_received);
+    fprintf(file, "  \"packets_rejected\": %u,\n", stats.packets_rejected);
+    fprintf(file, "  \"bytes_dropped\": %u,\n", result.bytes_dropped);
+    fprintf(file, "  \"bytes_corrupted\": %u,\n", result.bytes_corrupted);
+    fprintf(file, "  \"lock_losses\": %u,\n", stats.lock_losses);
+    fprintf(file, "  \"first_lock_s\": %.3f,\n", result.first_lock_s);
+    fprintf(file, "  \"drift_ppb\": %d,\n", stats.drift_ppb);
+    fprintf(file, "  \"true_drift_ppb\": %.0f,\n", result.true_drift_ppb);
+    print_error_stats(file, "locked_error", result.locked, false);
+    print_error_stats(file, "holdover_error", result.holdover,
+                      !config.repeat);
+    if (config.repeat)
+        print_error_stats(file, "repeated_edge_error", result.repeated, true);
+    fprintf(file, "}\n");
+}
+
+void print_usage(const char* program)
+{
+    fprintf(stderr,
+            "Usage: %s [--seconds N] [--warmup-s N] [--sample-us N] "
+            "[--capture edge|isr] [--ppm X] [--wander-ppb X] "
+            "[--latency-us X] [--spike-prob P] [--spike-us X] "
+            "[--drop-prob P] [--corrupt-prob P] [--unplug START_S:DURATION_S] "
+            "[--outlier-bound-us N] [--seed N] [--max-error-us X] "
+            "[--max-lock-losses N] [--repeat] [--output FILE]\n", program);
+}
+
+int main(int argc, char* argv[])
+{
+    sim_config_t config;
+    const char* output_path = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if ((i + 1 < argc) && (arg == "--seconds"))
+            config.seconds = strtoul(argv[++i], nullptr, 10);
+        else if ((i + 1 < argc) && (arg == "--warmup-s"))
+            config.warmup_s = strtoul(argv[++i], nullptr, 10);
+        else if ((i + 1 < argc) && (arg == "--sample-us"))
+            config.sample_us = strtoul(argv[++i], nullptr, 10);
+        else if ((i + 1 < argc) && (arg == "--capture"))
+            config.edge_capture = (strcmp(argv[++i], "isr") != 0);
+        else if ((i + 1 < argc) && (arg == "--ppm"))
+            config.ppm = strtod(argv[++i], nullptr);
+        else if ((i + 1 < argc) && (arg == "--wander-ppb"))
+            config.wander_ppb = strtod(argv[++i], nullptr);
+        else if ((i + 1 < argc) && (arg == "--latency-us"))
+            config.latency_us = strtod(argv[++i], nullptr);
+        else if ((i + 1 < argc) && (arg == "--spike-prob"))
+            config.spike_prob = strtod(argv[++i], nullptr);
+        else if ((i + 1 < argc) && (arg == "--spike-us"))
+            config.spike_us = strtod(argv[++i], nullptr);
+        else if ((i + 1 < argc) && (arg == "--drop-prob"))
+            config.drop_prob = strtod(argv[++i], nullptr);
+        else if ((i + 1 < argc) && (arg == "--corrupt-prob"))
+            config.corrupt_prob = strtod(argv[++i], nullptr);
+        else if ((i + 1 < argc) && (arg == "--unplug"))
+        {
+            char* duration = nullptr;
+            double start_s = strtod(argv[++i], &duration);
+            if (*duration != ':')
+            {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            config.unplugs.push_back({start_s,
+                                      strtod(duration + 1, nullptr)});
+        }
+        else if ((i + 1 < argc) && (arg == "--outlier-bound-us"))
+            config.outlier_bound_us = strtoll(argv[++i], nullptr, 10);
+        else if ((i + 1 < argc) && (arg == "--seed"))
+            config.seed = strtoul(argv[++i], nullptr, 10);
+        else if ((i + 1 < argc) && (arg == "--max-error-us"))
+            config.max_error_us = strtod(argv[++i], nullptr);
+        else if ((i + 1 < argc) && (arg == "--max-lock-losses"))
+            config.max_lock_losses = strtoll(argv[++i], nullptr, 10);
+        else if (arg == "--repeat")
+            config.repeat = true;
+        else if ((i + 1 < argc) && (arg == "--output"))
+            output_path = argv[++i];
+        else
+        {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (config.sample_us == 0)
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    sim_result_t result = run(config);
+
+    const error_stats_t& locked = result.locked;
+    fprintf(stderr, "%u packets sent, %u received, %u rejected, "
+            "%u lock losses, first lock at %.2f[s]\n",
+            result.packets_sent, result.sync_stats.packets_received,
+            result.sync_stats.packets_rejected, result.sync_stats.lock_losses,
+            result.first_lock_s);
+    fprintf(stderr, "locked error [us]: mean %.2f | p50 %.2f | p95 %.2f | "
+            "p99 %.2f | max %.2f (%u samples)\n", locked.mean_us,
+            locked.p50_abs_us, locked.p95_abs_us, locked.p99_abs_us,
+            locked.max_abs_us, locked.samples);
+    if (result.holdover.samples > 0)
+        fprintf(stderr, "holdover error [us]: max %.2f (%u samples)\n",
+                result.holdover.max_abs_us, result.holdover.samples);
+    fprintf(stderr, "drift [ppb]: estimated %d | true %.0f\n",
+            result.sync_stats.drift_ppb, result.true_drift_ppb);
+    if (config.repeat)
+        fprintf(stderr, "repeated edge error [us]: mean %.2f | p50 %.2f | "
+                "p99 %.2f | max %.2f (%u packets)\n",
+                result.repeated.mean_us, result.repeated.p50_abs_us,
+                result.repeated.p99_abs_us, result.repeated.max_abs_us,
+                result.repeated.samples);
+
+    FILE* output = stdout;
+    if (output_path != nullptr)
+    {
+        output = fopen(output_path, "w");
+        if (output == nullptr)
+        {
+            fprintf(stderr, "Could not open %s.\n", output_path);
+            return EXIT_FAILURE;
+        }
+    }
+    print_json(output, config, result);
+    if (output != stdout)
+        fclose(output);
+
+    if ((config.max_error_us > 0)
+        && ((locked.samples == 0) || (locked.max_abs_us > config.max_error_us)))
+    {
+        fprintf(stderr, "Locked error exceeded %.2f[us].\n",
+                config.max_error_us);
+        return EXIT_FAILURE;
+    }
+    if ((config.max_lock_losses >= 0)
+        && (result.sync_stats.lock_losses > config.max_lock_losses))
+    {
+        fprintf(stderr, "Lock losses exceeded %lld.\n",
+                (long long)config.max_lock_losses);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""Set a device's Harp time to this PC's clock over usb, NTP-style.
+
+For devices without a clock sync cable. Writing R_TIMESTAMP_SECOND sets the
+time with no latency compensation, so a device ends up milliseconds off.
+Instead, this script runs many round trips through the R_TIME_PROBE register,
+which records when the device received each request and when it replied.
+For a round trip that left the PC at t1 and came back at t4:
+    delay = (t4 - t1) - (tx - rx)
+    offset = ((rx - t1) + (tx - t4)) / 2
+The offset is exact if the trip was symmetric, and round trips with the least
+delay are the most symmetric, so only those are kept. The correction is then
+written to R_TIME_ADJUST, and the offset is measured again to check it.
+"""
+import argparse
+import os
+import serial
+import struct
+from statistics import median
+from time import perf_counter_ns, time_ns
+
+
+R_TIMESTAMP_SECOND = 8
+R_TIME_PROBE = 253 # vendor-private diagnostic registers.
+R_TIME_ADJUST = 254
+WRITE = 2
+U32 = 4
+S32 = 0x84
+U64 = 8
+# Reply: 5-byte header + 6-byte timestamp + 16-byte payload + 1-byte checksum.
+PROBE_REPLY_SIZE = 28
+MAX_ADJUST_US = 1000 * 1000000 # step the seconds first if further off.
+
+
+class HostClock:
+    """This PC's wall clock in [us], read from a monotonic counter so that it
+    does not jump during the measurement."""
+    def __init__(self):
+        self.base_perf_ns = perf_counter_ns()
+        self.base_time_ns = time_ns()
+
+    def now_us(self):
+        return (self.base_time_ns + perf_counter_ns() - self.base_perf_ns) \
+            / 1000.0
+
+
+def write_frame(address: int, payload_type: int, payload: bytes):
+    frame = bytearray([WRITE, 4 + len(payload), address, 255, payload_type])
+    frame += payload
+    frame.append(sum(frame) & 0xFF)
+    return bytes(frame)
+
+
+def write_register(ser, address: int, payload_type: int, payload: bytes):
+    """Write a register and discard its reply."""
+    ser.write(write_frame(address, payload_type, payload))
+    reply = ser.read(5 + 6 + len(payload) + 1)
+    if len(reply) == 0 or reply[0] != WRITE:
+        raise RuntimeError(f"Write to register {address} failed.")
+
+
+def measure_offset(ser, clock: HostClock, round_trips: int,
+                   best_fraction: float):
+    """Return (offset, min delay, round trips kept) in [us].
+    The offset is the device's Harp time minus the PC's time."""
+    probe = write_frame(R_TIME_PROBE, U64, bytes(16))
+    samples = []
+    for i in range(round_trips):
+        t1_us = clock.now_us()
+        ser.write(probe)
+        reply = ser.read(PROBE_REPLY_SIZE)
+        t4_us = clock.now_us()
+        if len(reply) < PROBE_REPLY_SIZE or reply[0] != WRITE \
+                or (sum(reply[:-1]) & 0xFF) != reply[-1]:
+            ser.reset_input_buffer()
+            continue
+        rx_us, tx_us = struct.unpack_from("<QQ", reply, 11)
+        delay_us = (t4_us - t1_us) - (tx_us - rx_us)
+        offset_us = ((rx_us - t1_us) + (tx_us - t4_us)) / 2.0
+        samples.append((delay_us, offset_us))
+    if not samples:
+        raise RuntimeError("Device did not reply to any time probe.")
+    samples.sort()
+    best = samples[:max(1, int(len(samples) * best_fraction))]
+    return median(offset for _, offset in best), best[0][0], len(best)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    default_port = "/dev/ttyACM0" if os.name == 'posix' else "COM95"
+    parser.add_argument("--port", default=default_port)
+    parser.add_argument("--round-trips", type=int, default=500)
+    parser.add_argument("--best-fraction", type=float, default=0.1,
+                        help="fraction of round trips with the least delay "
+                             "to compute the offset from.")
+    parser.add_argument("--measure-only", action="store_true",
+                        help="report the offset without correcting it.")
+    args = parser.parse_args()
+
+    clock = HostClock()
+    ser = serial.Serial(args.port, timeout=1.0)
+    ser.reset_input_buffer()
+
+    offset_us, delay_us, kept = measure_offset(ser, clock, args.round_trips,
+                                               args.best_fraction)
+    print(f"offset: {offset_us:.1f}[us] (min round trip delay "
+          f"{delay_us:.1f}[us], {kept}/{args.round_trips} round trips kept)")
+    if not args.measure_only:
+        if abs(offset_us) > MAX_ADJUST_US:
+            # Too far off to adjust. Get within a second first.
+            seconds = int(clock.now_us() // 1000000)
+            write_register(ser, R_TIMESTAMP_SECOND, U32,
+                           struct.pack("<I", seconds))
+            offset_us, _, _ = measure_offset(ser, clock, args.round_trips,
+                                             args.best_fraction)
+        write_register(ser, R_TIME_ADJUST, S32,
+                       struct.pack("<i", -round(offset_us)))
+        offset_us, delay_us, kept = measure_offset(ser, clock,
+                                                   args.round_trips,
+                                                   args.best_fraction)
+        print(f"offset after adjusting: {offset_us:.1f}[us] (min round trip "
+              f"delay {delay_us:.1f}[us])")
+    ser.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+"""Measure how many harp replies per second the device can emit.
+
+Sends bursts of READ requests without waiting for each reply (unlike
+test_reply_speed.py, which is stop-and-wait) and times how long it takes for
+all replies to arrive. Bursts of increasing size show whether throughput
+scales with the number of requests in flight. Run against two firmware builds
+to compare them.
+"""
+import serial
+import os
+from time import perf_counter
+
+
+BURST_SIZES = [1, 2, 4, 8, 16, 32] # requests in flight per burst.
+BURSTS = 1000
+R_OPERATION_CTRL = 10
+U8 = 1
+# Reply: 5-byte header + 6-byte timestamp + 1-byte payload + 1-byte checksum.
+REPLY_SIZE = 13
+
+
+def read_frame(address: int, payload_type: int):
+    frame = bytearray([1, 4, address, 255, payload_type])
+    frame.append(sum(frame) & 0xFF)
+    return bytes(frame)
+
+
+def measure_throughput(ser, burst_size: int):
+    """Return (replies, elapsed seconds) for BURSTS bursts of burst_size."""
+    burst = read_frame(R_OPERATION_CTRL, U8) * burst_size
+    expected_bytes = REPLY_SIZE * burst_size
+    received_bytes = 0
+    start_time_s = perf_counter()
+    for i in range(BURSTS):
+        ser.write(burst)
+        reply = ser.read(expected_bytes)
+        received_bytes += len(reply)
+        if len(reply) < expected_bytes:
+            print(f"Timed out on burst {i}: received {len(reply)}/"
+                  f"{expected_bytes} bytes.")
+            break
+    return received_bytes // REPLY_SIZE, perf_counter() - start_time_s
+
+
+if os.name == 'posix': # check for Linux.
+    port = "/dev/ttyACM0"
+else: # assume Windows.
+    port = "COM95"
+
+ser = serial.Serial(port, timeout=1.0)
+ser.reset_input_buffer()
+
+print(f"Sending {BURSTS}x bursts of READ requests per burst size.")
+print(f"{'burst size':>10} | {'replies/s':>10} | {'KB/s':>8}")
+for burst_size in BURST_SIZES:
+    replies, elapsed_s = measure_throughput(ser, burst_size)
+    print(f"{burst_size:>10} | {replies / elapsed_s:>10.1f} | "
+          f"{replies * REPLY_SIZE / elapsed_s / 1000.0:>8.1f}")
+ser.close()